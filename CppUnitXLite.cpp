@@ -29,20 +29,145 @@ THE SOFTWARE.
  */
 
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cctype>
 #include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <coroutine>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <latch>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <new>
+#include <regex>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+#if defined(__linux__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <link.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 #include "CppUnitXLite.hpp"
+#include "CppUnitXLiteAsync.hpp"
+
+
+/**
+ * Formats one message straight into a MessageArena, with no intermediate
+ * string to allocate and copy.
+ */
+class MessageStream : public std::ostream
+{
+public:
+  explicit MessageStream(MessageArena &arena) : std::ostream(&buffer), buffer(arena) { }
+
+  ~MessageStream() override { buffer.arena.discard(); }
+
+  std::string_view finish() { return buffer.arena.finish(); }
+
+private:
+  struct Buffer : std::streambuf
+  {
+    explicit Buffer(MessageArena &theArena) : arena(theArena) { }
+
+    int_type overflow(int_type character) override;
+
+    std::streamsize xsputn(const char *text, std::streamsize length) override;
+
+    MessageArena &arena;
+  };
+
+  Buffer buffer;
+};
+
 
 Test::Test(const char *theTestName)
-: testName(theTestName),
-  nextTest(NULL)
+: groupName(""),
+  testName(theTestName),
+  fileName("<unknown>"),
+  lineNumber(0)
+{
+  TestRegistry::addTest(this);
+}
+
+
+Test::Test(const char *theGroupName, const char *theTestName)
+: groupName(theGroupName),
+  testName(theTestName),
+  fileName("<unknown>"),
+  lineNumber(0)
+{
+  TestRegistry::addTest(this);
+}
+
+
+Test::Test(const char *theGroupName, const char *theTestName, const char *theFileName, unsigned int theLineNumber)
+: groupName(theGroupName),
+  testName(theTestName),
+  fileName(theFileName),
+  lineNumber(theLineNumber)
 {
   TestRegistry::addTest(this);
 }
 
 
+Test::Test(const TestEntry &entry)
+: groupName(entry.group),
+  testName(entry.name),
+  fileName(entry.file),
+  lineNumber(entry.line),
+  timeoutSeconds(entry.timeoutSeconds)
+{
+}
+
+
+void
+ConstexprChecks::failed(const char *, const char *, unsigned int)
+{
+}
+
+
 template<>
 bool
 Test::checkEqual<const char *>(const char *expected,
@@ -51,28 +176,4980 @@ Test::checkEqual<const char *>(const char *expected,
                  const char *fileName,
                  unsigned lineNumber)
 {
+  countCheck(result);
   expected = expected != NULL ? expected : "<null>";
   actual = actual != NULL ? actual : "<null>";
   bool successful = std::string(expected) == std::string(actual);
   if (!successful)
   {
-    std::ostringstream message;
+    MessageStream message(result.messages());
     message << "expected: " << expected << " but received: " << actual;
-    fail(result, message.str().c_str(), fileName, lineNumber);
+    recordFailure(result, message.finish(), fileName, lineNumber);
   }
   return successful;
 }
 
 
-void TestRegistry::add(Test *test)
+#if defined(CPP_UNIT_X_LITE_TRACK_ALLOCATIONS)
+namespace {
+
+// Constant initialized, so operator new may count before main() and on
+// threads that have run no constructors yet.
+thread_local AllocationCounts threadAllocations;
+
+void *
+countedAllocation(std::size_t size, std::size_t alignment)
 {
-  if (tests != NULL) test->next(tests);
-  tests = test;
+  for (;;)
+  {
+    void *memory = NULL;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) memory = std::malloc(size != 0 ? size : 1);
+    else memory = std::aligned_alloc(alignment, (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment);
+    if (memory != NULL)
+    {
+      ++threadAllocations.allocations;
+      threadAllocations.bytes += size;
+      return memory;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == NULL) throw std::bad_alloc();
+    handler();
+  }
 }
 
+void *
+countedAllocation(std::size_t size, std::size_t alignment, const std::nothrow_t &) noexcept
+{
+  try { return countedAllocation(size, alignment); }
+  catch (...) { return NULL; }
+}
 
-void TestRegistry::run(TestResult &result)
+void
+countedFree(void *memory) noexcept
 {
-  for (Test *test = tests; test != NULL; test = test->next()) test->run(result);
-  result.testsEnded();
+  if (memory == NULL) return;
+  ++threadAllocations.deallocations;
+  std::free(memory);
+}
+
+} // namespace
+
+
+void *operator new(std::size_t size) { return countedAllocation(size, 0); }
+void *operator new[](std::size_t size) { return countedAllocation(size, 0); }
+void *operator new(std::size_t size, std::align_val_t alignment) { return countedAllocation(size, static_cast<std::size_t>(alignment)); }
+void *operator new[](std::size_t size, std::align_val_t alignment) { return countedAllocation(size, static_cast<std::size_t>(alignment)); }
+void *operator new(std::size_t size, const std::nothrow_t &tag) noexcept { return countedAllocation(size, 0, tag); }
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept { return countedAllocation(size, 0, tag); }
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept
+{
+  return countedAllocation(size, static_cast<std::size_t>(alignment), tag);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &tag) noexcept
+{
+  return countedAllocation(size, static_cast<std::size_t>(alignment), tag);
+}
+
+void operator delete(void *memory) noexcept { countedFree(memory); }
+void operator delete[](void *memory) noexcept { countedFree(memory); }
+void operator delete(void *memory, std::size_t) noexcept { countedFree(memory); }
+void operator delete[](void *memory, std::size_t) noexcept { countedFree(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete(void *memory, const std::nothrow_t &) noexcept { countedFree(memory); }
+void operator delete[](void *memory, const std::nothrow_t &) noexcept { countedFree(memory); }
+void operator delete(void *memory, std::align_val_t, const std::nothrow_t &) noexcept { countedFree(memory); }
+void operator delete[](void *memory, std::align_val_t, const std::nothrow_t &) noexcept { countedFree(memory); }
+
+
+auto
+AllocationScope::counts() -> AllocationCounts
+{
+  return threadAllocations;
+}
+
+
+auto
+AllocationScope::tracking() -> bool
+{
+  return true;
+}
+#else
+auto
+AllocationScope::counts() -> AllocationCounts
+{
+  return AllocationCounts();
+}
+
+
+auto
+AllocationScope::tracking() -> bool
+{
+  return false;
+}
+#endif
+
+
+auto
+Test::checkAllocations(TestResult &result, const AllocationScope &scope, const char *fileName, unsigned int lineNumber) -> bool
+{
+  AllocationCounts used = scope.used();
+  countCheck(result);
+  if (used.allocations <= scope.maxAllocations && used.bytes <= scope.maxBytes) return true;
+  MessageStream message(result.messages());
+  message << "allocated " << used.allocations << " times, " << used.bytes << " bytes, where at most "
+          << scope.maxAllocations << " allocations and " << scope.maxBytes << " bytes are allowed";
+  return recordFailure(result, message.finish(), fileName, lineNumber);
+}
+
+
+namespace {
+const std::size_t messageBlockSize = 16384;
+}
+
+
+auto
+MessageArena::store(std::string_view text) -> std::string_view
+{
+  append(text.data(), text.size());
+  return finish();
+}
+
+
+void
+MessageArena::append(const char *text, std::size_t length)
+{
+  if (length == 0) return;
+  if (static_cast<std::size_t>(limit - cursor) < length) grow(length);
+  if (open == NULL) open = cursor;
+  std::memcpy(cursor, text, length);
+  cursor += length;
+}
+
+
+auto
+MessageArena::finish() -> std::string_view
+{
+  std::string_view message(open, open != NULL ? static_cast<std::size_t>(cursor - open) : 0);
+  open = NULL;
+  return message;
+}
+
+
+void
+MessageArena::discard()
+{
+  if (open != NULL) cursor = open;
+  open = NULL;
+}
+
+
+void
+MessageArena::adopt(MessageArena &&other)
+{
+  other.discard();
+  for (std::vector<char> &block : other.blocks) blocks.push_back(std::move(block));
+  other.blocks.clear();
+  other.cursor = other.limit = NULL;
+}
+
+
+void
+MessageArena::clear()
+{
+  discard();
+  if (blocks.empty()) return;
+  blocks.erase(blocks.begin(), blocks.end() - 1);
+  cursor = blocks.back().data();
+  limit = cursor + blocks.back().size();
+}
+
+
+auto
+MessageArena::capacity() const -> std::size_t
+{
+  std::size_t bytes = 0;
+  for (const std::vector<char> &block : blocks) bytes += block.size();
+  return bytes;
+}
+
+
+// Start a new block, carrying over the part of the open message already
+// written, so the message stays contiguous.
+void
+MessageArena::grow(std::size_t length)
+{
+  std::size_t used = open != NULL ? static_cast<std::size_t>(cursor - open) : 0;
+  std::size_t size = std::max(messageBlockSize, 2 * (used + length));
+  char *block = blocks.emplace_back(size).data();
+  if (used > 0) std::memcpy(block, open, used);
+  if (open != NULL) open = block;
+  cursor = block + used;
+  limit = block + size;
+}
+
+
+auto
+MessageStream::Buffer::overflow(int_type character) -> int_type
+{
+  if (traits_type::eq_int_type(character, traits_type::eof())) return traits_type::not_eof(character);
+  char c = traits_type::to_char_type(character);
+  arena.append(&c, 1);
+  return character;
+}
+
+
+auto
+MessageStream::Buffer::xsputn(const char *text, std::streamsize length) -> std::streamsize
+{
+  arena.append(text, static_cast<std::size_t>(length));
+  return length;
+}
+
+
+void
+FormattedValue::print(MessageStream &out) const
+{
+  switch (kind)
+  {
+  case Kind::boolean:
+  case Kind::natural: out << natural; break;
+  case Kind::character: out << character; break;
+  case Kind::integer: out << integer; break;
+  case Kind::real: out << real; break;
+  case Kind::text: out << text; break;
+  case Kind::pointer: out << const_cast<const void *>(pointer); break;
+  case Kind::streamed: stream(out, object); break;
+  case Kind::unprintable: out << '?'; break;
+  }
+}
+
+
+auto
+Test::recordComparison(TestResult &result,
+                       const char *before,
+                       const FormattedValue &expected,
+                       const char *between,
+                       const FormattedValue &actual,
+                       const char *fileName,
+                       unsigned int lineNumber) -> bool
+{
+  MessageStream message(result.messages());
+  message << before;
+  expected.print(message);
+  message << between;
+  actual.print(message);
+  return recordFailure(result, message.finish(), fileName, lineNumber);
+}
+
+
+namespace {
+
+/// Print the elements of range within a few places of index.
+void
+printWindow(MessageStream &out, const RangeView &range, std::size_t index)
+{
+  const std::size_t reach = 3;
+  std::size_t first = index > reach ? index - reach : 0;
+  std::size_t last = std::min(index + reach + 1, range.size);
+  out << '[';
+  if (first > 0) out << "... ";
+  for (std::size_t i = first; i < last; ++i)
+  {
+    if (i > first) out << ", ";
+    range.printElement(out, range.range, i);
+  }
+  if (last < range.size) out << " ...";
+  out << ']';
+}
+
+} // namespace
+
+
+auto
+Test::recordRangeMismatch(TestResult &result,
+                          const RangeView &expected,
+                          const RangeView &actual,
+                          std::size_t difference,
+                          const char *fileName,
+                          unsigned int lineNumber) -> bool
+{
+  MessageStream message(result.messages());
+  if (expected.size != actual.size) message << "expected " << expected.size << " elements but received " << actual.size << "; ";
+  if (difference < std::min(expected.size, actual.size))
+  {
+    message << "first difference at index " << difference << ": expected ";
+    expected.printElement(message, expected.range, difference);
+    message << " but received ";
+    actual.printElement(message, actual.range, difference);
+    message << "; ";
+  }
+  message << "expected ";
+  printWindow(message, expected, difference);
+  message << " received ";
+  printWindow(message, actual, difference);
+  return recordFailure(result, message.finish(), fileName, lineNumber);
+}
+
+
+namespace {
+
+/**
+ * What checkAllApproxEqual() learns about two arrays.  The SIMD loops only
+ * fill in outside, firstOutside, largestError and squares; the index of
+ * the largest error is looked up once a failure has to be reported.
+ */
+struct ApproxSummary
+{
+  std::size_t outside = 0;
+  std::size_t firstOutside = 0;
+  double largestError = 0.0;
+  double squares = 0.0;
+};
+
+
+template<typename Real, typename Bits>
+unsigned long long
+ulpDistance(Real expected, Real actual)
+{
+  Bits x;
+  Bits y;
+  std::memcpy(&x, &expected, sizeof x);
+  std::memcpy(&y, &actual, sizeof y);
+  // Map the sign and magnitude bit patterns onto one unsigned scale on
+  // which neighbouring values are adjacent integers.
+  const Bits sign = Bits(1) << (8 * sizeof(Bits) - 1);
+  x = (x & sign) != 0 ? ~x : (x | sign);
+  y = (y & sign) != 0 ? ~y : (y | sign);
+  return x > y ? x - y : y - x;
+}
+
+unsigned long long
+ulpDistance(float expected, float actual) { return ulpDistance<float, std::uint32_t>(expected, actual); }
+
+unsigned long long
+ulpDistance(double expected, double actual) { return ulpDistance<double, std::uint64_t>(expected, actual); }
+
+
+template<typename Real>
+bool
+withinTolerance(Real expected, Real actual, const ApproxTolerance &tolerance)
+{
+  if (std::isnan(expected) || std::isnan(actual)) return false;
+  if (expected == actual) return true;
+  double error = std::fabs(static_cast<double>(expected) - static_cast<double>(actual));
+  double scale = std::max(std::fabs(static_cast<double>(expected)), std::fabs(static_cast<double>(actual)));
+  return error <= tolerance.absolute || error <= tolerance.relative * scale ||
+         ulpDistance(expected, actual) <= tolerance.ulps;
+}
+
+
+// The SIMD loops decide absolute and relative tolerance; elements failing
+// both come here to be judged by ULPs as well.
+template<typename Real>
+void
+recheck(const Real *expected, const Real *actual, std::size_t index, const ApproxTolerance &tolerance, ApproxSummary &summary)
+{
+  if (withinTolerance(expected[index], actual[index], tolerance)) return;
+  if (summary.outside++ == 0) summary.firstOutside = index;
+}
+
+
+template<typename Real>
+void
+summarizeScalar(const Real *expected, const Real *actual, std::size_t first, std::size_t count,
+                const ApproxTolerance &tolerance, ApproxSummary &summary)
+{
+  for (std::size_t i = first; i < count; ++i)
+  {
+    double error = std::fabs(expected[i] - actual[i]);
+    summary.squares += error * error;
+    if (error > summary.largestError) summary.largestError = error;
+    recheck(expected, actual, i, tolerance, summary);
+  }
+}
+
+
+#if defined(__x86_64__) && defined(__GNUC__)
+void
+summarizeSse2(const float *expected, const float *actual, std::size_t count,
+              const ApproxTolerance &tolerance, ApproxSummary &summary)
+{
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128 absolute = _mm_set1_ps(static_cast<float>(tolerance.absolute));
+  const __m128 relative = _mm_set1_ps(static_cast<float>(tolerance.relative));
+  __m128 largest = _mm_setzero_ps();
+  __m128d squares = _mm_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 e = _mm_loadu_ps(expected + i);
+    __m128 a = _mm_loadu_ps(actual + i);
+    __m128 error = _mm_andnot_ps(signMask, _mm_sub_ps(e, a));
+    __m128 scale = _mm_max_ps(_mm_andnot_ps(signMask, e), _mm_andnot_ps(signMask, a));
+    __m128 within = _mm_or_ps(_mm_cmple_ps(error, absolute), _mm_cmple_ps(error, _mm_mul_ps(relative, scale)));
+    largest = _mm_max_ps(error, largest);
+    __m128d low = _mm_cvtps_pd(error);
+    __m128d high = _mm_cvtps_pd(_mm_movehl_ps(error, error));
+    squares = _mm_add_pd(squares, _mm_add_pd(_mm_mul_pd(low, low), _mm_mul_pd(high, high)));
+    int mask = _mm_movemask_ps(within);
+    if (mask != 0xf)
+    {
+      for (int lane = 0; lane < 4; ++lane) if ((mask & (1 << lane)) == 0) recheck(expected, actual, i + lane, tolerance, summary);
+    }
+  }
+  alignas(16) float lanes[4];
+  alignas(16) double sums[2];
+  _mm_store_ps(lanes, largest);
+  _mm_store_pd(sums, squares);
+  for (float lane : lanes) summary.largestError = std::max(summary.largestError, static_cast<double>(lane));
+  summary.squares += sums[0] + sums[1];
+  summarizeScalar(expected, actual, i, count, tolerance, summary);
+}
+
+void
+summarizeSse2(const double *expected, const double *actual, std::size_t count,
+              const ApproxTolerance &tolerance, ApproxSummary &summary)
+{
+  const __m128d signMask = _mm_set1_pd(-0.0);
+  const __m128d absolute = _mm_set1_pd(tolerance.absolute);
+  const __m128d relative = _mm_set1_pd(tolerance.relative);
+  __m128d largest = _mm_setzero_pd();
+  __m128d squares = _mm_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 2 <= count; i += 2)
+  {
+    __m128d e = _mm_loadu_pd(expected + i);
+    __m128d a = _mm_loadu_pd(actual + i);
+    __m128d error = _mm_andnot_pd(signMask, _mm_sub_pd(e, a));
+    __m128d scale = _mm_max_pd(_mm_andnot_pd(signMask, e), _mm_andnot_pd(signMask, a));
+    __m128d within = _mm_or_pd(_mm_cmple_pd(error, absolute), _mm_cmple_pd(error, _mm_mul_pd(relative, scale)));
+    largest = _mm_max_pd(error, largest);
+    squares = _mm_add_pd(squares, _mm_mul_pd(error, error));
+    int mask = _mm_movemask_pd(within);
+    if (mask != 0x3)
+    {
+      for (int lane = 0; lane < 2; ++lane) if ((mask & (1 << lane)) == 0) recheck(expected, actual, i + lane, tolerance, summary);
+    }
+  }
+  alignas(16) double lanes[2];
+  alignas(16) double sums[2];
+  _mm_store_pd(lanes, largest);
+  _mm_store_pd(sums, squares);
+  summary.largestError = std::max(summary.largestError, std::max(lanes[0], lanes[1]));
+  summary.squares += sums[0] + sums[1];
+  summarizeScalar(expected, actual, i, count, tolerance, summary);
+}
+
+__attribute__((target("avx2"))) void
+summarizeAvx2(const float *expected, const float *actual, std::size_t count,
+              const ApproxTolerance &tolerance, ApproxSummary &summary)
+{
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  const __m256 absolute = _mm256_set1_ps(static_cast<float>(tolerance.absolute));
+  const __m256 relative = _mm256_set1_ps(static_cast<float>(tolerance.relative));
+  __m256 largest = _mm256_setzero_ps();
+  __m256d squares = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256 e = _mm256_loadu_ps(expected + i);
+    __m256 a = _mm256_loadu_ps(actual + i);
+    __m256 error = _mm256_andnot_ps(signMask, _mm256_sub_ps(e, a));
+    __m256 scale = _mm256_max_ps(_mm256_andnot_ps(signMask, e), _mm256_andnot_ps(signMask, a));
+    __m256 within = _mm256_or_ps(_mm256_cmp_ps(error, absolute, _CMP_LE_OQ),
+                                 _mm256_cmp_ps(error, _mm256_mul_ps(relative, scale), _CMP_LE_OQ));
+    largest = _mm256_max_ps(error, largest);
+    __m256d low = _mm256_cvtps_pd(_mm256_castps256_ps128(error));
+    __m256d high = _mm256_cvtps_pd(_mm256_extractf128_ps(error, 1));
+    squares = _mm256_add_pd(squares, _mm256_add_pd(_mm256_mul_pd(low, low), _mm256_mul_pd(high, high)));
+    int mask = _mm256_movemask_ps(within);
+    if (mask != 0xff)
+    {
+      for (int lane = 0; lane < 8; ++lane) if ((mask & (1 << lane)) == 0) recheck(expected, actual, i + lane, tolerance, summary);
+    }
+  }
+  alignas(32) float lanes[8];
+  alignas(32) double sums[4];
+  _mm256_store_ps(lanes, largest);
+  _mm256_store_pd(sums, squares);
+  for (float lane : lanes) summary.largestError = std::max(summary.largestError, static_cast<double>(lane));
+  summary.squares += sums[0] + sums[1] + sums[2] + sums[3];
+  summarizeScalar(expected, actual, i, count, tolerance, summary);
+}
+
+__attribute__((target("avx2"))) void
+summarizeAvx2(const double *expected, const double *actual, std::size_t count,
+              const ApproxTolerance &tolerance, ApproxSummary &summary)
+{
+  const __m256d signMask = _mm256_set1_pd(-0.0);
+  const __m256d absolute = _mm256_set1_pd(tolerance.absolute);
+  const __m256d relative = _mm256_set1_pd(tolerance.relative);
+  __m256d largest = _mm256_setzero_pd();
+  __m256d squares = _mm256_setzero_pd();
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256d e = _mm256_loadu_pd(expected + i);
+    __m256d a = _mm256_loadu_pd(actual + i);
+    __m256d error = _mm256_andnot_pd(signMask, _mm256_sub_pd(e, a));
+    __m256d scale = _mm256_max_pd(_mm256_andnot_pd(signMask, e), _mm256_andnot_pd(signMask, a));
+    __m256d within = _mm256_or_pd(_mm256_cmp_pd(error, absolute, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(error, _mm256_mul_pd(relative, scale), _CMP_LE_OQ));
+    largest = _mm256_max_pd(error, largest);
+    squares = _mm256_add_pd(squares, _mm256_mul_pd(error, error));
+    int mask = _mm256_movemask_pd(within);
+    if (mask != 0xf)
+    {
+      for (int lane = 0; lane < 4; ++lane) if ((mask & (1 << lane)) == 0) recheck(expected, actual, i + lane, tolerance, summary);
+    }
+  }
+  alignas(32) double lanes[4];
+  alignas(32) double sums[4];
+  _mm256_store_pd(lanes, largest);
+  _mm256_store_pd(sums, squares);
+  for (double lane : lanes) summary.largestError = std::max(summary.largestError, lane);
+  summary.squares += sums[0] + sums[1] + sums[2] + sums[3];
+  summarizeScalar(expected, actual, i, count, tolerance, summary);
+}
+#endif
+
+
+template<typename Real>
+ApproxSummary
+summarize(const Real *expected, const Real *actual, std::size_t count, const ApproxTolerance &tolerance)
+{
+  ApproxSummary summary;
+#if defined(__x86_64__) && defined(__GNUC__)
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if (avx2) summarizeAvx2(expected, actual, count, tolerance, summary);
+  else summarizeSse2(expected, actual, count, tolerance, summary);
+#else
+  summarizeScalar(expected, actual, 0, count, tolerance, summary);
+#endif
+  return summary;
+}
+
+} // namespace
+
+
+template<typename Real>
+auto
+Test::checkAllApproxEqualImplementation(std::span<const Real> expected,
+                                        std::span<const Real> actual,
+                                        const ApproxTolerance &tolerance,
+                                        TestResult &result,
+                                        const char *fileName,
+                                        unsigned int lineNumber) -> bool
+{
+  countCheck(result);
+  if (expected.size() != actual.size())
+  {
+    MessageStream message(result.messages());
+    message << "expected " << expected.size() << " elements but received " << actual.size();
+    return recordFailure(result, message.finish(), fileName, lineNumber);
+  }
+
+  ApproxSummary summary = summarize(expected.data(), actual.data(), expected.size(), tolerance);
+  if (summary.outside == 0) return true;
+
+  // Errors are computed in the precision of Real, as the SIMD loops do.
+  std::size_t largestAt = 0;
+  for (std::size_t i = 0; i < expected.size(); ++i)
+  {
+    Real error = std::fabs(expected[i] - actual[i]);
+    if (static_cast<double>(error) == summary.largestError) { largestAt = i; break; }
+  }
+  MessageStream message(result.messages());
+  message.precision(std::numeric_limits<Real>::max_digits10);
+  message << summary.outside << " of " << expected.size() << " elements out of tolerance, the first at index "
+          << summary.firstOutside << "; largest error " << summary.largestError
+          << " at index " << largestAt << " (expected " << expected[largestAt] << " but received " << actual[largestAt]
+          << "); RMS error " << std::sqrt(summary.squares / static_cast<double>(expected.size()));
+  return recordFailure(result, message.finish(), fileName, lineNumber);
+}
+
+
+auto
+Test::checkAllApproxEqual(std::span<const float> expected,
+                          std::span<const float> actual,
+                          const ApproxTolerance &tolerance,
+                          TestResult &result,
+                          const char *fileName,
+                          unsigned int lineNumber) -> bool
+{
+  return checkAllApproxEqualImplementation(expected, actual, tolerance, result, fileName, lineNumber);
+}
+
+
+auto
+Test::checkAllApproxEqual(std::span<const double> expected,
+                          std::span<const double> actual,
+                          const ApproxTolerance &tolerance,
+                          TestResult &result,
+                          const char *fileName,
+                          unsigned int lineNumber) -> bool
+{
+  return checkAllApproxEqualImplementation(expected, actual, tolerance, result, fileName, lineNumber);
+}
+
+
+void
+BenchmarkState::start()
+{
+  started = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void
+BenchmarkState::stop()
+{
+  stopped = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void
+Benchmark::escape(const volatile void *)
+{
+}
+
+
+void
+Benchmark::run(TestResult &result)
+{
+  const long long sampleTarget = 10000000;  // ten milliseconds
+  const unsigned int sampleCount = 20;
+
+  // Grow the iteration count until one sample lasts long enough for the
+  // clock to resolve it well.
+  unsigned long long iterations = 1;
+  for (;;)
+  {
+    BenchmarkState state(iterations);
+    benchmark(state);
+    long long elapsed = std::max(state.elapsedNanoseconds(), 1LL);
+    if (elapsed >= sampleTarget || iterations >= 1000000000ULL) break;
+    double scale = std::min(10.0, 1.2 * static_cast<double>(sampleTarget) / static_cast<double>(elapsed));
+    iterations = std::max(iterations + 1, static_cast<unsigned long long>(static_cast<double>(iterations) * scale));
+  }
+
+  BenchmarkStats stats;
+  stats.name = name();
+  stats.iterations = iterations;
+  stats.samples = sampleCount;
+  std::vector<double> perIteration;
+  unsigned long long bytes = 0;
+  unsigned long long items = 0;
+  for (unsigned int sample = 0; sample < sampleCount; ++sample)
+  {
+    BenchmarkState state(iterations);
+    benchmark(state);
+    perIteration.push_back(static_cast<double>(state.elapsedNanoseconds()) / static_cast<double>(iterations));
+    bytes = state.bytes();
+    items = state.items();
+  }
+
+  double sum = 0.0;
+  for (double time : perIteration) sum += time;
+  stats.mean = sum / sampleCount;
+  double squares = 0.0;
+  for (double time : perIteration) squares += (time - stats.mean) * (time - stats.mean);
+  stats.stddev = std::sqrt(squares / (sampleCount - 1));
+  std::sort(perIteration.begin(), perIteration.end());
+  stats.median = (perIteration[(sampleCount - 1) / 2] + perIteration[sampleCount / 2]) / 2.0;
+  if (stats.mean > 0.0)
+  {
+    stats.bytesPerSecond = static_cast<double>(bytes) * 1.0e9 / stats.mean;
+    stats.itemsPerSecond = static_cast<double>(items) * 1.0e9 / stats.mean;
+  }
+  result.addBenchmark(stats);
+}
+
+
+namespace {
+
+#if defined(__unix__) || defined(__APPLE__)
+void lockForFork();
+void unlockAfterFork(bool inChild);
+#endif
+
+struct Baseline
+{
+  double median;
+  double deviation;  // median absolute deviation
+  std::size_t samples;
+};
+
+
+/**
+ * The CHECK_NOT_SLOWER baselines of the run, keyed by group/test/key.  In
+ * update mode checks record into it and the run writes it back.
+ */
+class Baselines
+{
+public:
+  static Baselines &
+  instance()
+  {
+    static Baselines baselines;
+    return baselines;
+  }
+
+  void
+  load(const std::string &theFileName, bool update)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    fileName = theFileName;
+    updating = update;
+    entries.clear();
+    if (fileName.empty()) return;
+    std::ifstream in(fileName.c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream fields(line);
+      std::string key;
+      Baseline baseline;
+      if (fields >> key >> baseline.median >> baseline.deviation >> baseline.samples) entries[key] = baseline;
+    }
+  }
+
+  bool
+  find(const std::string &key, Baseline &baseline)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(key);
+    if (entry == entries.end()) return false;
+    baseline = entry->second;
+    return true;
+  }
+
+  /// Keep baseline for saving, if this run updates the file.
+  bool
+  record(const std::string &key, const Baseline &baseline)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!updating) return false;
+    entries[key] = baseline;
+    return true;
+  }
+
+  void
+  save()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!updating || fileName.empty()) return;
+    std::ofstream out(fileName.c_str(), std::ios::out | std::ios::trunc);
+    out << "# group/test/key median-ns mad-ns samples\n";
+    out.precision(17);
+    for (const auto &entry : entries)
+    {
+      out << entry.first << ' ' << entry.second.median << ' ' << entry.second.deviation << ' ' << entry.second.samples << '\n';
+    }
+    if (!out) throw std::runtime_error("cannot write baselines to " + fileName);
+  }
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+  friend void lockForFork();
+  friend void unlockAfterFork(bool inChild);
+#endif
+
+  std::mutex mutex;
+  std::string fileName;
+  bool updating = false;
+  std::map<std::string, Baseline> entries;
+};
+
+
+double
+median(std::vector<double> values)
+{
+  if (values.empty()) return 0.0;
+  std::size_t middle = values.size() / 2;
+  std::nth_element(values.begin(), values.begin() + middle, values.end());
+  double upper = values[middle];
+  if (values.size() % 2 != 0) return upper;
+  return (*std::max_element(values.begin(), values.begin() + middle) + upper) / 2.0;
+}
+
+
+/// Standard error of a median, from a median absolute deviation: the MAD
+/// scaled to a standard deviation, times the median's efficiency factor.
+double
+medianError(const Baseline &baseline)
+{
+  if (baseline.samples == 0) return 0.0;
+  return 1.2533 * 1.4826 * baseline.deviation / std::sqrt(static_cast<double>(baseline.samples));
+}
+
+} // namespace
+
+
+auto
+PerformanceSample::nextBatch() -> bool
+{
+  const long long batchTarget = 1000000;  // one millisecond
+  const std::size_t sampleCount = 21;
+
+  long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (started != 0)
+  {
+    long long elapsed = std::max(now - started, 1LL);
+    if (calibrated)
+    {
+      times.push_back(static_cast<double>(elapsed) / static_cast<double>(batch));
+      if (times.size() == sampleCount) return false;
+    }
+    else if (elapsed >= batchTarget || batch >= 1000000000ULL)
+    {
+      calibrated = true;
+    }
+    else
+    {
+      double scale = std::min(10.0, 1.2 * static_cast<double>(batchTarget) / static_cast<double>(elapsed));
+      batch = std::max(batch + 1, static_cast<unsigned long long>(static_cast<double>(batch) * scale));
+    }
+  }
+  remaining = batch - 1;
+  started = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  return true;
+}
+
+
+auto
+Test::checkNotSlower(TestResult &result, const PerformanceSample &sample, const char *fileName, unsigned int lineNumber) -> bool
+{
+  countCheck(result);
+  std::string key(group());
+  key.append(1, '/').append(name()).append(1, '/').append(sample.key);
+  std::replace_if(key.begin(), key.end(), [](char character) { return std::isspace(static_cast<unsigned char>(character)) != 0; }, '_');
+
+  Baseline measured;
+  measured.median = median(sample.samples());
+  std::vector<double> deviations;
+  for (double time : sample.samples()) deviations.push_back(std::fabs(time - measured.median));
+  measured.deviation = median(deviations);
+  measured.samples = sample.samples().size();
+
+  Baseline baseline;
+  if (Baselines::instance().record(key, measured) || !Baselines::instance().find(key, baseline)) return true;
+
+  // Slower only if beyond the tolerance and beyond three standard errors
+  // of the difference between the two medians.
+  double slowdown = measured.median - baseline.median;
+  double noise = 3.0 * std::hypot(medianError(measured), medianError(baseline));
+  if (slowdown <= baseline.median * sample.tolerance || slowdown <= noise) return true;
+
+  MessageStream message(result.messages());
+  message.setf(std::ios::fixed);
+  message.precision(1);
+  message << sample.key << ": median " << measured.median << " ns is " << 100.0 * slowdown / baseline.median
+          << "% slower than the baseline " << baseline.median << " ns (tolerance " << 100.0 * sample.tolerance
+          << "%, MAD " << measured.deviation << " ns against " << baseline.deviation << " ns)";
+  return recordFailure(result, message.finish(), fileName, lineNumber);
+}
+
+
+namespace {
+
+/// Set from RunOptions::updateSnapshots before the tests run.
+bool updatingSnapshots = false;
+
+
+/// The golden file snapshots/name next to the source file fileName.
+std::string
+snapshotPath(std::string_view name, std::string_view fileName)
+{
+  if (!name.empty() && name[0] == '/') return std::string(name);
+  std::size_t slash = fileName.find_last_of("/\\");
+  std::string path(slash == std::string_view::npos ? std::string_view() : fileName.substr(0, slash + 1));
+  return path.append("snapshots/").append(name);
+}
+
+
+/// Where golden and actual first differ, comparing 64 KiB at a time.
+std::size_t
+firstDifference(std::span<const std::byte> golden, std::span<const std::byte> actual)
+{
+  std::size_t common = std::min(golden.size(), actual.size());
+  for (std::size_t offset = 0; offset < common; offset += 65536)
+  {
+    std::size_t length = std::min<std::size_t>(65536, common - offset);
+    if (std::memcmp(golden.data() + offset, actual.data() + offset, length) != 0)
+    {
+      return static_cast<std::size_t>(std::mismatch(golden.begin() + static_cast<std::ptrdiff_t>(offset), golden.end(),
+                                                    actual.begin() + static_cast<std::ptrdiff_t>(offset)).first - golden.begin());
+    }
+  }
+  return common;
+}
+
+
+/// Whether the 4 KiB either side of offset are printable text.
+bool
+looksLikeText(std::span<const std::byte> bytes, std::size_t offset)
+{
+  std::size_t first = offset > 4096 ? offset - 4096 : 0;
+  std::size_t last = std::min(bytes.size(), offset + 4096);
+  for (std::size_t i = first; i < last; ++i)
+  {
+    unsigned char character = static_cast<unsigned char>(bytes[i]);
+    if ((character < 0x20 && character != '\t' && character != '\n' && character != '\r') || character == 0x7f) return false;
+  }
+  return true;
+}
+
+
+/// Up to count lines of text from start, each cut at 120 characters, each after prefix.
+void
+showLines(std::ostream &out, std::string_view text, std::size_t start, int count, const char *prefix)
+{
+  for (int shown = 0; shown < count && start < text.size(); ++shown)
+  {
+    std::size_t end = std::min(text.find('\n', start), text.size());
+    std::string_view line = text.substr(start, end - start);
+    out << '\n' << prefix << line.substr(0, 120) << (line.size() > 120 ? "..." : "");
+    start = end + 1;
+  }
+}
+
+
+/// The rows of 16 bytes either side of offset, each after prefix.
+void
+showBytes(std::ostream &out, std::span<const std::byte> bytes, std::size_t offset, const char *prefix)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::size_t row = (offset & ~std::size_t(15)) - std::min<std::size_t>(offset & ~std::size_t(15), 16);
+  for (int rows = 0; rows < 3 && row < bytes.size(); ++rows, row += 16)
+  {
+    char address[24];
+    std::snprintf(address, sizeof address, "%08zx:", row);
+    out << '\n' << prefix << address;
+    for (std::size_t i = row; i < std::min(row + 16, bytes.size()); ++i)
+    {
+      unsigned char value = static_cast<unsigned char>(bytes[i]);
+      out << ' ' << digits[value >> 4] << digits[value & 15];
+    }
+  }
+}
+
+
+/// Replace the file at path with bytes by renaming a complete copy over it.
+bool
+writeSnapshot(const std::string &path, std::span<const std::byte> bytes)
+{
+  std::error_code error;
+  std::filesystem::path target(path);
+  if (target.has_parent_path()) std::filesystem::create_directories(target.parent_path(), error);
+  std::string temporary = path + ".new";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!out.flush()) return false;
+  }
+  std::filesystem::rename(temporary, target, error);
+  return !error;
+}
+
+} // namespace
+
+
+auto
+Test::firstDifferingByte(const void *expected, const void *actual, std::size_t length) -> std::size_t
+{
+  return firstDifference(std::span(static_cast<const std::byte *>(expected), length),
+                         std::span(static_cast<const std::byte *>(actual), length));
+}
+
+
+auto
+Test::checkSnapshot(std::string_view snapshotName, std::span<const std::byte> actual, TestResult &result,
+                    const char *fileName, unsigned int lineNumber) -> bool
+{
+  countCheck(result);
+  std::string path = snapshotPath(snapshotName, fileName);
+  MappedFile golden;
+  bool found = golden.open(path);
+  std::size_t difference = found ? firstDifference(golden.bytes(), actual) : 0;
+  if (found && difference == golden.size() && difference == actual.size()) return true;
+
+  MessageStream message(result.messages());
+  if (updatingSnapshots)
+  {
+    golden.close();
+    if (writeSnapshot(path, actual)) return true;
+    message << "cannot write snapshot " << path << ": " << std::strerror(errno);
+  }
+  else if (!found)
+  {
+    message << "no snapshot " << path << " (" << std::strerror(errno) << "); --update-snapshots writes it";
+  }
+  else
+  {
+    message << "snapshot " << path << " differs at byte " << difference << " (golden " << golden.size()
+            << " bytes, actual " << actual.size() << ")";
+    std::string_view goldenText = golden.text();
+    std::string_view actualText(reinterpret_cast<const char *>(actual.data()), actual.size());
+    if (looksLikeText(golden.bytes(), difference) && looksLikeText(actual, difference))
+    {
+      // The texts agree up to the line that differs, so count lines in either.
+      std::size_t start = goldenText.rfind('\n', difference == 0 ? 0 : difference - 1);
+      start = start == std::string_view::npos || difference == 0 ? 0 : start + 1;
+      message << ", line " << std::count(goldenText.begin(), goldenText.begin() + static_cast<std::ptrdiff_t>(start), '\n') + 1 << ':';
+      std::size_t context = start;
+      for (int lines = 0; lines < 2 && context > 0; ++lines)
+      {
+        std::size_t previous = context >= 2 ? goldenText.rfind('\n', context - 2) : std::string_view::npos;
+        context = previous == std::string_view::npos ? 0 : previous + 1;
+      }
+      std::ptrdiff_t contextLines = std::count(goldenText.begin() + static_cast<std::ptrdiff_t>(context),
+                                               goldenText.begin() + static_cast<std::ptrdiff_t>(start), '\n');
+      showLines(message, goldenText, context, static_cast<int>(contextLines), "  ");
+      showLines(message, goldenText, start, 3, "- ");
+      showLines(message, actualText, start, 3, "+ ");
+    }
+    else
+    {
+      message << ':';
+      showBytes(message, golden.bytes(), difference, "- ");
+      showBytes(message, actual, difference, "+ ");
+    }
+  }
+  return recordFailure(result, message.finish(), fileName, lineNumber);
+}
+
+
+namespace {
+
+#if defined(__unix__) || defined(__APPLE__)
+bool
+writeFully(int fd, const char *data, std::size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t written = ::write(fd, data, length);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    data += written;
+    length -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+#endif
+
+
+class ConsoleWriter;
+ConsoleWriter &console();
+
+/**
+ * Prints the output of every TestResult on standard output from a
+ * background thread.  Producers push records, which refer to text kept in
+ * their result's arena, into a bounded lock-free queue and return at once.
+ * The writer formats the records it finds into one buffer and prints it
+ * with a single write(2) whenever it is woken: at the end of a test that
+ * printed, when the queue is half full, or when a producer must know its
+ * records are out (drain()).  Nothing wakes it while tests pass.
+ */
+class ConsoleWriter
+{
+public:
+  ConsoleWriter()
+  : slots(new Slot[capacity]),
+    enqueued(0),
+    dequeued(0),
+    requests(0),
+    completed(0),
+    stopping(false),
+    started(false)
+  {
+    for (std::size_t i = 0; i < capacity; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+#if defined(__unix__) || defined(__APPLE__)
+    ::pthread_atfork(NULL, NULL, []() { console().forked(); });
+#endif
+  }
+
+  ~ConsoleWriter()
+  {
+    if (!writer) return;
+    stopping.store(true);
+    wake();
+    writer->join();
+  }
+
+  void post(std::string_view fileName, unsigned int lineNumber, std::string_view message)
+  {
+    // The first producer starts the writer; the others go on queueing,
+    // since the writer sees every request made before it waits.
+    if (!started.load(std::memory_order_acquire) && !started.exchange(true))
+    {
+      writer.reset(new std::thread([this]() { work(); }));
+    }
+
+    std::size_t position = enqueued.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Slot &slot = slots[position % capacity];
+      std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence == position)
+      {
+        if (enqueued.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+        {
+          slot.fileName = fileName;
+          slot.lineNumber = lineNumber;
+          slot.message = message;
+          slot.sequence.store(position + 1, std::memory_order_release);
+          break;
+        }
+      }
+      else if (sequence < position)
+      {
+        // Full: make sure the writer is draining, then wait for room.
+        wake();
+        std::this_thread::yield();
+        position = enqueued.load(std::memory_order_relaxed);
+      }
+      else
+      {
+        position = enqueued.load(std::memory_order_relaxed);
+      }
+    }
+    if (position + 1 - dequeued.load(std::memory_order_relaxed) == capacity / 2) wake();
+  }
+
+  /// Ask the writer to print what it has, without waiting for it.
+  void flush() { wake(); }
+
+  /// Return once every record posted before the call is printed.
+  void drain()
+  {
+    if (!started.load()) return;
+    std::uint64_t ticket = wake();
+    for (std::uint64_t done = completed.load(); done < ticket; done = completed.load()) completed.wait(done);
+  }
+
+private:
+  /// In the child of a fork(): the writer thread and the records still
+  /// queued belong to the parent, so start over with an empty queue and a
+  /// writer that the next post() starts.  The parent's std::thread is let
+  /// go, not destroyed, since destroying a joinable thread terminates.
+  void
+  forked()
+  {
+    static_cast<void>(writer.release());
+    started.store(false);
+    for (std::size_t i = 0; i < capacity; ++i) slots[i].sequence.store(i, std::memory_order_relaxed);
+    enqueued.store(0);
+    dequeued.store(0);
+    requests.store(0);
+    completed.store(0);
+    stopping.store(false);
+  }
+
+  // A record with no file name is plain text.
+  struct Slot
+  {
+    std::atomic<std::size_t> sequence;
+    std::string_view fileName;
+    unsigned int lineNumber;
+    std::string_view message;
+  };
+
+  static constexpr std::size_t capacity = 4096;
+  static constexpr std::size_t batchSize = 1 << 16;
+
+  std::uint64_t wake()
+  {
+    std::uint64_t ticket = requests.fetch_add(1) + 1;
+    requests.notify_one();
+    return ticket;
+  }
+
+  void work()
+  {
+    std::string batch;
+    batch.reserve(batchSize);
+    std::uint64_t seen = 0;
+    for (;;)
+    {
+      requests.wait(seen);
+      seen = requests.load();
+      for (;;)
+      {
+        std::size_t position = dequeued.load(std::memory_order_relaxed);
+        Slot &slot = slots[position % capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) break;
+        if (slot.fileName.empty())
+        {
+          batch.append(slot.message);
+        }
+        else
+        {
+          batch.append(slot.fileName).append(1, ':').append(std::to_string(slot.lineNumber));
+          batch.append(":0 test \"").append(slot.message).append("\" failed\n");
+        }
+        slot.sequence.store(position + capacity, std::memory_order_release);
+        dequeued.store(position + 1, std::memory_order_relaxed);
+        if (batch.size() >= batchSize) print(batch);
+      }
+      print(batch);
+      completed.store(seen);
+      completed.notify_all();
+      if (stopping.load()) return;
+    }
+  }
+
+  static void print(std::string &batch)
+  {
+    if (batch.empty()) return;
+    std::cout.flush();
+#if defined(__unix__) || defined(__APPLE__)
+    writeFully(STDOUT_FILENO, batch.data(), batch.size());
+#else
+    std::fwrite(batch.data(), 1, batch.size(), stdout);
+    std::fflush(stdout);
+#endif
+    batch.clear();
+  }
+
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<std::size_t> enqueued;
+  std::atomic<std::size_t> dequeued;
+  std::atomic<std::uint64_t> requests;
+  std::atomic<std::uint64_t> completed;
+  std::atomic<bool> stopping;
+  std::atomic<bool> started;
+  std::unique_ptr<std::thread> writer;
+};
+
+
+ConsoleWriter &
+console()
+{
+  static ConsoleWriter writer;
+  return writer;
+}
+
+
+/// The entry of group in groups, kept sorted by group, and whether it was
+/// just added.
+template<typename Value>
+std::pair<Value *, bool>
+groupEntry(std::vector<std::pair<std::string, Value>> &groups, std::string_view group)
+{
+  auto entry = std::lower_bound(groups.begin(), groups.end(), group,
+                                [](const std::pair<std::string, Value> &candidate, std::string_view name) { return candidate.first < name; });
+  if (entry != groups.end() && entry->first == group) return std::make_pair(&entry->second, false);
+  return std::make_pair(&groups.insert(entry, std::make_pair(std::string(group), Value()))->second, true);
+}
+
+/// Add one test's counts to the running total of its group.  A count is
+/// valid in the total only if it was valid for every test.
+void
+addCounters(std::vector<std::pair<std::string, PerfCounts>> &groups, std::string_view group, const PerfCounts &counts)
+{
+  std::pair<PerfCounts *, bool> total = groupEntry(groups, group);
+  if (total.second) *total.first = counts;
+  else
+  {
+    total.first->hardware = total.first->hardware && counts.hardware;
+    total.first->software = total.first->software && counts.software;
+    total.first->cycles += counts.cycles;
+    total.first->instructions += counts.instructions;
+    total.first->branchMisses += counts.branchMisses;
+    total.first->cacheMisses += counts.cacheMisses;
+    total.first->taskClockNanoseconds += counts.taskClockNanoseconds;
+    total.first->pageFaults += counts.pageFaults;
+    total.first->contextSwitches += counts.contextSwitches;
+  }
+}
+
+} // namespace
+
+
+TestResult::~TestResult()
+{
+  if (printed) console().drain();
+}
+
+
+void
+TestResult::addFailure(const Failure &failure)
+{
+  printed = true;
+  console().post(failure.fileName, failure.lineNumber, failure.message);
+  addFailureCount();
+}
+
+
+void
+TestResult::print(std::string_view text)
+{
+  printed = true;
+  console().post(std::string_view(), 0, text);
+}
+
+
+void
+TestResult::releaseMessages()
+{
+  if (printed) console().drain();
+  printed = false;
+  messageArena.clear();
+}
+
+
+void
+TestResult::testCached(const Test &)
+{
+  ++cachedCount;
+}
+
+
+void
+TestResult::testsEnded()
+{
+  MessageStream line(messages());
+  if (failureCount > 0) line << "There were " << failureCount << " failures\n";
+  else line << "There were no test failures\n";
+  if (cachedCount > 0) line << "Skipped " << cachedCount << " tests that passed before in this build\n";
+  print(line.finish());
+  if (slowestLength > 0) printTimingSummary();
+  if (allocationsReported) printAllocationSummary();
+  if (countersReported) printCounterSummary();
+  console().drain();
+}
+
+
+void
+TestResult::addBenchmark(const BenchmarkStats &stats)
+{
+  MessageStream line(messages());
+  line.setf(std::ios::fixed);
+  line.precision(2);
+  line << stats.name << ": " << stats.mean << " ns/op (median " << stats.median
+       << ", stddev " << stats.stddev << ", " << stats.samples << " samples of "
+       << stats.iterations << " iterations)";
+  if (stats.bytesPerSecond > 0.0) line << ", " << stats.bytesPerSecond / 1.0e6 << " MB/s";
+  if (stats.itemsPerSecond > 0.0) line << ", " << stats.itemsPerSecond / 1.0e6 << " M items/s";
+  line << '\n';
+  print(line.finish());
+  console().flush();
+}
+
+
+void
+TestResult::addThroughput(const ThroughputStats &stats)
+{
+  MessageStream line(messages());
+  line.setf(std::ios::fixed);
+  line.precision(2);
+  double total = 0.0;
+  for (double rate : stats.opsPerSecond) total += rate;
+  line << stats.name << ": " << stats.threads << " threads of " << stats.iterations << " iterations in "
+       << stats.seconds << " s, " << total / 1.0e6 << " M ops/s; per thread";
+  for (double rate : stats.opsPerSecond) line << ' ' << rate / 1.0e6;
+  line << '\n';
+  print(line.finish());
+  console().flush();
+}
+
+
+void
+TestResult::testEnded(const Test &test, const TestStats &stats)
+{
+  if (printed) console().flush();
+  if (allocationsReported && (stats.allocations > 0 || stats.liveAllocations != 0)) allocatingTests.emplace_back(&test, stats);
+  if (countersReported) addCounters(groupCounters, test.group(), stats.counters);
+  if (slowestLength == 0) return;
+
+  GroupSeconds &group = *groupEntry(groupSeconds, test.group()).first;
+  group.test += stats.wallSeconds;
+  group.setup += stats.setupSeconds;
+  group.teardown += stats.teardownSeconds;
+
+  if (slowestTests.size() < slowestLength || stats.wallSeconds > slowestTests.back().first)
+  {
+    auto position = std::find_if(slowestTests.begin(), slowestTests.end(),
+                                 [&stats](const std::pair<double, const Test *> &entry) { return entry.first < stats.wallSeconds; });
+    slowestTests.insert(position, std::make_pair(stats.wallSeconds, &test));
+    if (slowestTests.size() > slowestLength) slowestTests.pop_back();
+  }
+}
+
+
+void
+TestResult::printTimingSummary()
+{
+  MessageStream summary(messages());
+  summary.setf(std::ios::fixed);
+  summary.precision(6);
+  summary << "Slowest tests:\n";
+  for (const auto &entry : slowestTests)
+  {
+    summary << "  " << entry.first << " s  ";
+    if (!entry.second->group().empty()) summary << entry.second->group() << '.';
+    summary << entry.second->name() << '\n';
+  }
+  summary << "Time per test group:\n";
+  for (const auto &entry : groupSeconds)
+  {
+    summary << "  " << entry.second.test << " s  " << (entry.first.empty() ? "<no group>" : entry.first);
+    if (entry.second.setup > 0.0 || entry.second.teardown > 0.0)
+    {
+      summary << " (fixtures: " << entry.second.setup << " s setup, " << entry.second.teardown << " s teardown)";
+    }
+    summary << '\n';
+  }
+  print(summary.finish());
+}
+
+
+namespace {
+
+void
+appendXml(std::string &text, std::string_view value)
+{
+  for (char character : value)
+  {
+    switch (character)
+    {
+    case '&': text.append("&amp;"); break;
+    case '<': text.append("&lt;"); break;
+    case '>': text.append("&gt;"); break;
+    case '"': text.append("&quot;"); break;
+    case '\'': text.append("&apos;"); break;
+    case '\n': text.append("&#10;"); break;
+    case '\t': text.append("&#9;"); break;
+    default:
+      // XML 1.0 cannot carry the other control characters at all.
+      text.append(1, static_cast<unsigned char>(character) < 0x20 ? '?' : character);
+      break;
+    }
+  }
+}
+
+
+void
+appendJson(std::string &text, std::string_view value)
+{
+  text.append(1, '"');
+  for (char character : value)
+  {
+    switch (character)
+    {
+    case '"': text.append("\\\""); break;
+    case '\\': text.append("\\\\"); break;
+    case '\n': text.append("\\n"); break;
+    case '\t': text.append("\\t"); break;
+    default:
+      if (static_cast<unsigned char>(character) < 0x20)
+      {
+        char escaped[8];
+        std::snprintf(escaped, sizeof escaped, "\\u%04x", static_cast<unsigned int>(character));
+        text.append(escaped);
+      }
+      else text.append(1, character);
+      break;
+    }
+  }
+  text.append(1, '"');
+}
+
+
+void
+appendNumber(std::string &text, double value, const char *format = "%.6f")
+{
+  char number[64];
+  std::snprintf(number, sizeof number, format, value);
+  text.append(number);
+}
+
+
+} // namespace
+
+
+ReportFile::ReportFile(const std::string &fileName)
+{
+  std::unique_ptr<std::ostream> opened(new std::ofstream(fileName.c_str(), std::ios::out | std::ios::trunc));
+  if (!*opened) throw std::runtime_error("cannot write test report " + fileName);
+  file = opened.release();
+}
+
+
+ReportFile::~ReportFile()
+{
+  delete file;
+}
+
+
+JUnitXmlResult::JUnitXmlResult(const std::string &fileName)
+: file(fileName),
+  out(file.stream())
+{
+  start();
+}
+
+
+JUnitXmlResult::JUnitXmlResult(std::ostream &output)
+: out(output)
+{
+  start();
+}
+
+
+JUnitXmlResult::~JUnitXmlResult() = default;
+
+
+namespace {
+/// Room enough on the testsuite element for its three counts at their longest.
+const std::size_t suiteCountsWidth = 96;
+}
+
+
+void
+JUnitXmlResult::start()
+{
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n<testsuite name=\"CppUnitXLite\"";
+  suiteCounts = static_cast<long long>(out.tellp());
+  if (suiteCounts >= 0) out << std::string(suiteCountsWidth, ' ');
+  out << ">\n";
+}
+
+
+void
+JUnitXmlResult::addFailure(const Failure &failure)
+{
+  TestResult::addFailure(failure);
+  failures.append("    <failure message=\"");
+  appendXml(failures, failure.message);
+  failures.append("\">");
+  appendXml(failures, failure.fileName);
+  failures.append(1, ':').append(std::to_string(failure.lineNumber)).append("</failure>\n");
+}
+
+
+void
+JUnitXmlResult::testEnded(const Test &test, const TestStats &stats)
+{
+  TestResult::testEnded(test, stats);
+  std::string line("  <testcase classname=\"");
+  appendXml(line, test.group());
+  line.append("\" name=\"");
+  appendXml(line, test.name());
+  line.append("\" time=\"");
+  appendNumber(line, stats.wallSeconds);
+  ++testCount;
+  if (failures.empty())
+  {
+    line.append("\"/>\n");
+  }
+  else
+  {
+    line.append("\">\n").append(failures).append("  </testcase>\n");
+    failures.clear();
+    ++failedCount;
+  }
+  out.write(line.data(), static_cast<std::streamsize>(line.size()));
+  releaseMessages();
+}
+
+
+void
+JUnitXmlResult::testCached(const Test &test)
+{
+  TestResult::testCached(test);
+  std::string line("  <testcase classname=\"");
+  appendXml(line, test.group());
+  line.append("\" name=\"");
+  appendXml(line, test.name());
+  line.append("\" time=\"0\">\n    <skipped message=\"passed before in this build\"/>\n  </testcase>\n");
+  out.write(line.data(), static_cast<std::streamsize>(line.size()));
+  ++testCount;
+  ++skippedCount;
+}
+
+
+void
+JUnitXmlResult::testsEnded()
+{
+  TestResult::testsEnded();
+  out << "</testsuite>\n</testsuites>\n";
+  if (suiteCounts >= 0)
+  {
+    // Over the blanks start() left; the rest stay blanks inside the tag.
+    std::string counts(" tests=\"");
+    counts.append(std::to_string(testCount)).append("\" failures=\"").append(std::to_string(failedCount));
+    counts.append("\" skipped=\"").append(std::to_string(skippedCount)).append(1, '"');
+    out.seekp(static_cast<std::streamoff>(suiteCounts));
+    out.write(counts.data(), static_cast<std::streamsize>(counts.size()));
+    out.seekp(0, std::ios::end);
+  }
+  out.flush();
+}
+
+
+JsonLinesResult::JsonLinesResult(const std::string &fileName)
+: file(fileName),
+  out(file.stream())
+{ }
+
+
+JsonLinesResult::JsonLinesResult(std::ostream &output)
+: out(output)
+{ }
+
+
+JsonLinesResult::~JsonLinesResult() = default;
+
+
+void
+JsonLinesResult::addFailure(const Failure &failure)
+{
+  TestResult::addFailure(failure);
+  failures.append(failures.empty() ? "{\"file\":" : ",{\"file\":");
+  appendJson(failures, failure.fileName);
+  failures.append(",\"line\":").append(std::to_string(failure.lineNumber)).append(",\"message\":");
+  appendJson(failures, failure.message);
+  failures.append(1, '}');
+}
+
+
+void
+JsonLinesResult::addBenchmark(const BenchmarkStats &stats)
+{
+  TestResult::addBenchmark(stats);
+  std::string line("{\"benchmark\":");
+  appendJson(line, stats.name);
+  line.append(",\"iterations\":").append(std::to_string(stats.iterations));
+  line.append(",\"samples\":").append(std::to_string(stats.samples));
+  line.append(",\"meanNs\":");
+  appendNumber(line, stats.mean, "%.3f");
+  line.append(",\"medianNs\":");
+  appendNumber(line, stats.median, "%.3f");
+  line.append(",\"stddevNs\":");
+  appendNumber(line, stats.stddev, "%.3f");
+  line.append(",\"bytesPerSecond\":");
+  appendNumber(line, stats.bytesPerSecond, "%.0f");
+  line.append(",\"itemsPerSecond\":");
+  appendNumber(line, stats.itemsPerSecond, "%.0f");
+  line.append("}\n");
+  out.write(line.data(), static_cast<std::streamsize>(line.size()));
+}
+
+
+void
+JsonLinesResult::addThroughput(const ThroughputStats &stats)
+{
+  TestResult::addThroughput(stats);
+  std::string line("{\"concurrent\":");
+  appendJson(line, stats.name);
+  line.append(",\"threads\":").append(std::to_string(stats.threads));
+  line.append(",\"iterations\":").append(std::to_string(stats.iterations));
+  line.append(",\"seconds\":");
+  appendNumber(line, stats.seconds);
+  line.append(",\"opsPerSecond\":[");
+  for (std::size_t i = 0; i < stats.opsPerSecond.size(); ++i)
+  {
+    if (i > 0) line.append(1, ',');
+    appendNumber(line, stats.opsPerSecond[i], "%.0f");
+  }
+  line.append("]}\n");
+  out.write(line.data(), static_cast<std::streamsize>(line.size()));
+}
+
+
+void
+JsonLinesResult::testEnded(const Test &test, const TestStats &stats)
+{
+  TestResult::testEnded(test, stats);
+  std::string line("{\"group\":");
+  appendJson(line, test.group());
+  line.append(",\"test\":");
+  appendJson(line, test.name());
+  line.append(failures.empty() ? ",\"passed\":true" : ",\"passed\":false");
+  line.append(",\"seconds\":");
+  appendNumber(line, stats.wallSeconds);
+  if (stats.setupSeconds > 0.0 || stats.teardownSeconds > 0.0)
+  {
+    line.append(",\"setup\":");
+    appendNumber(line, stats.setupSeconds);
+    line.append(",\"teardown\":");
+    appendNumber(line, stats.teardownSeconds);
+  }
+  line.append(",\"checks\":").append(std::to_string(stats.checks));
+  line.append(",\"failures\":[").append(failures).append("]}\n");
+  failures.clear();
+  out.write(line.data(), static_cast<std::streamsize>(line.size()));
+  releaseMessages();
+}
+
+
+void
+JsonLinesResult::testCached(const Test &test)
+{
+  TestResult::testCached(test);
+  std::string line("{\"group\":");
+  appendJson(line, test.group());
+  line.append(",\"test\":");
+  appendJson(line, test.name());
+  line.append(",\"passed\":true,\"cached\":true}\n");
+  out.write(line.data(), static_cast<std::streamsize>(line.size()));
+}
+
+
+void
+JsonLinesResult::testsEnded()
+{
+  TestResult::testsEnded();
+  out.flush();
+}
+
+
+void
+TestResult::printAllocationSummary()
+{
+  MessageStream summary(messages());
+  summary << "Allocations per test:";
+  if (!AllocationScope::tracking()) summary << " not counted; compile CppUnitXLite.cpp with CPP_UNIT_X_LITE_TRACK_ALLOCATIONS";
+  summary << '\n';
+  for (const auto &entry : allocatingTests)
+  {
+    summary << "  " << entry.second.allocations << " allocations, " << entry.second.allocatedBytes << " bytes, "
+            << entry.second.liveAllocations << " live  ";
+    if (!entry.first->group().empty()) summary << entry.first->group() << '.';
+    summary << entry.first->name() << '\n';
+  }
+  print(summary.finish());
+}
+
+
+void
+TestResult::printCounterSummary()
+{
+  MessageStream summary(messages());
+  summary.setf(std::ios::fixed);
+  summary.precision(2);
+  summary << "Counters per test group:";
+  if (groupCounters.empty() || (!groupCounters.begin()->second.hardware && !groupCounters.begin()->second.software))
+  {
+    summary << " not available";
+  }
+  summary << '\n';
+  for (const auto &entry : groupCounters)
+  {
+    const PerfCounts &counts = entry.second;
+    summary << "  " << (entry.first.empty() ? "<no group>" : entry.first) << ':';
+    if (counts.hardware)
+    {
+      summary << ' ' << counts.cycles << " cycles, " << counts.instructions << " instructions ("
+              << (counts.cycles != 0 ? static_cast<double>(counts.instructions) / static_cast<double>(counts.cycles) : 0.0)
+              << " IPC), " << counts.branchMisses << " branch misses, " << counts.cacheMisses << " cache misses";
+    }
+    if (counts.hardware && counts.software) summary << ',';
+    if (counts.software)
+    {
+      summary << ' ' << static_cast<double>(counts.taskClockNanoseconds) / 1.0e6 << " ms task clock, " << counts.pageFaults
+              << " page faults, " << counts.contextSwitches << " context switches";
+    }
+    summary << '\n';
+  }
+  print(summary.finish());
+}
+
+
+RunOptions
+RunOptions::fromCommandLine(int argc, char **argv)
+{
+  RunOptions options;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string argument(argv[i]);
+    std::string value;
+    if (argument.rfind("--jobs=", 0) == 0) value = argument.substr(7);
+    else if (argument.rfind("-j", 0) == 0) value = argument.substr(2);
+    else if (argument.rfind("--durations=", 0) == 0)
+    {
+      options.durationsFile = argument.substr(12);
+      continue;
+    }
+    else if (argument.rfind("--slowest=", 0) == 0)
+    {
+      char *end = NULL;
+      options.slowest = static_cast<unsigned int>(std::strtoul(argv[i] + 10, &end, 10));
+      if (end == argv[i] + 10 || *end != '\0') throw std::invalid_argument("bad count in " + argument);
+      continue;
+    }
+    else if (argument.rfind("--reporter=", 0) == 0)
+    {
+      options.reporter = argument.substr(11);
+      bool known = (options.reporter.rfind("junit:", 0) == 0 || options.reporter.rfind("jsonl:", 0) == 0) &&
+                   options.reporter.size() > 6;
+      if (!known) throw std::invalid_argument("bad reporter in " + argument + ", expected junit:PATH or jsonl:PATH");
+      continue;
+    }
+    else if (argument.rfind("--filter=", 0) == 0)
+    {
+      options.filters.push_back(argument.substr(9));
+      continue;
+    }
+    else if (argument.rfind("--exclude=", 0) == 0)
+    {
+      options.excludes.push_back(argument.substr(10));
+      continue;
+    }
+    else if (argument == "--list")
+    {
+      options.list = true;
+      continue;
+    }
+    else if (argument == "--allocations")
+    {
+      options.allocations = true;
+      continue;
+    }
+    else if (argument == "--counters")
+    {
+      options.counters = true;
+      continue;
+    }
+    else if (argument.rfind("--baselines=", 0) == 0)
+    {
+      options.baselinesFile = argument.substr(12);
+      continue;
+    }
+    else if (argument == "--update-baselines")
+    {
+      options.updateBaselines = true;
+      continue;
+    }
+    else if (argument == "--pin-threads")
+    {
+      options.pinThreads = true;
+      continue;
+    }
+    else if (argument.rfind("--yield=", 0) == 0)
+    {
+      char *end = NULL;
+      options.yieldOneIn = static_cast<unsigned int>(std::strtoul(argv[i] + 8, &end, 10));
+      if (end == argv[i] + 8 || *end != '\0') throw std::invalid_argument("bad count in " + argument);
+      continue;
+    }
+    else if (argument == "--update-snapshots")
+    {
+      options.updateSnapshots = true;
+      continue;
+    }
+    else if (argument.rfind("--cache=", 0) == 0)
+    {
+      options.cacheFile = argument.substr(8);
+      continue;
+    }
+    else if (argument.rfind("--cache-inputs=", 0) == 0)
+    {
+      std::istringstream paths(argument.substr(15));
+      std::string path;
+      while (std::getline(paths, path, ',')) if (!path.empty()) options.cacheInputs.push_back(path);
+      continue;
+    }
+    else if (argument.rfind("--profile=", 0) == 0)
+    {
+      options.profileFile = argument.substr(10);
+      continue;
+    }
+    else if (argument.rfind("--timeout=", 0) == 0 || argument.rfind("--run-timeout=", 0) == 0)
+    {
+      std::size_t equals = argument.find('=');
+      char *end = NULL;
+      double seconds = std::strtod(argv[i] + equals + 1, &end);
+      if (end == argv[i] + equals + 1 || *end != '\0' || !(seconds >= 0.0)) throw std::invalid_argument("bad seconds in " + argument);
+      (argument.rfind("--timeout=", 0) == 0 ? options.timeoutSeconds : options.runTimeoutSeconds) = seconds;
+      continue;
+    }
+    else if (argument == "--rerun-failed")
+    {
+      options.rerunFailed = true;
+      continue;
+    }
+    else if (argument == "--bench")
+    {
+      options.benchmarks = true;
+      continue;
+    }
+    else if (argument == "--isolate")
+    {
+      options.isolate = true;
+      continue;
+    }
+    else if (argument.rfind("--shard=", 0) == 0)
+    {
+      char *slash = NULL;
+      char *end = NULL;
+      options.shardIndex = static_cast<unsigned int>(std::strtoul(argv[i] + 8, &slash, 10));
+      if (*slash == '/') options.shardCount = static_cast<unsigned int>(std::strtoul(slash + 1, &end, 10));
+      if (end == NULL || end == slash + 1 || *end != '\0' || options.shardIndex >= options.shardCount)
+      {
+        throw std::invalid_argument("bad shard in " + argument + ", expected --shard=i/N with i < N");
+      }
+      continue;
+    }
+    else throw std::invalid_argument("unknown option " + argument);
+
+    char *end = NULL;
+    unsigned long jobs = std::strtoul(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0') throw std::invalid_argument("bad job count in " + argument);
+    options.jobs = static_cast<unsigned int>(jobs);
+  }
+  if (options.updateBaselines && options.baselinesFile.empty())
+  {
+    throw std::invalid_argument("--update-baselines needs --baselines=PATH");
+  }
+  if (options.updateBaselines && options.isolate)
+  {
+    throw std::invalid_argument("--update-baselines cannot be used with --isolate");
+  }
+  if ((options.rerunFailed || !options.cacheInputs.empty()) && options.cacheFile.empty())
+  {
+    throw std::invalid_argument("--rerun-failed and --cache-inputs need --cache=PATH");
+  }
+  if (!options.profileFile.empty() && options.isolate)
+  {
+    throw std::invalid_argument("--profile cannot be used with --isolate");
+  }
+  return options;
+}
+
+
+namespace {
+
+/// Seconds of fixture setup and teardown in the test running on this thread.
+thread_local double fixtureSeconds[2];
+
+/// FixtureTimers running on this thread; only the outermost one counts.
+thread_local unsigned int fixtureTimers;
+
+/// The test of the innermost FixtureTimer on this thread given one, if any.
+thread_local const Test *timedFixtureTest;
+
+long long
+steadyNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * How many of the tests of each group selected for the run have not yet
+ * ended, and the shared fixtures each group holds a reference to until
+ * they all have.
+ */
+class FixtureGroups
+{
+public:
+  static FixtureGroups &instance()
+  {
+    static FixtureGroups groups;
+    return groups;
+  }
+
+  void expect(const std::vector<Test *> &tests)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    groups.clear();
+    for (const Test *test : tests) ++groups[test->group()].remaining;
+  }
+
+  /// Whether the group of test has newly taken a reference to fixture.
+  bool attach(SharedFixtureState &fixture, const Test &test)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto group = groups.find(test.group());
+    if (group == groups.end() || group->second.remaining == 0) return false;
+    std::vector<SharedFixtureState *> &held = group->second.fixtures;
+    if (std::find(held.begin(), held.end(), &fixture) != held.end()) return false;
+    held.push_back(&fixture);
+    return true;
+  }
+
+  /// Release the fixtures of the group of test if it was the last to end.
+  void ended(const Test &test)
+  {
+    std::vector<SharedFixtureState *> released;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto group = groups.find(test.group());
+      if (group == groups.end() || group->second.remaining == 0 || --group->second.remaining > 0) return;
+      released.swap(group->second.fixtures);
+    }
+    for (SharedFixtureState *fixture : released) fixture->release();
+  }
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+  friend void lockForFork();
+  friend void unlockAfterFork(bool inChild);
+#endif
+  struct Group
+  {
+    unsigned long remaining = 0;
+    std::vector<SharedFixtureState *> fixtures;
+  };
+
+  std::mutex mutex;
+  std::map<std::string_view, Group> groups;
+};
+
+} // namespace
+
+
+FixtureTimer::FixtureTimer(Phase thePhase, const Test *theTest)
+: phase(thePhase),
+  started(steadyNanoseconds()),
+  outerTest(timedFixtureTest)
+{
+  if (theTest != NULL) timedFixtureTest = theTest;
+  ++fixtureTimers;
+}
+
+
+FixtureTimer::~FixtureTimer()
+{
+  timedFixtureTest = outerTest;
+  if (--fixtureTimers > 0) return;
+  fixtureSeconds[phase == Phase::setup ? 0 : 1] += static_cast<double>(steadyNanoseconds() - started) * 1.0e-9;
+}
+
+
+struct SharedFixtureState::Lock
+{
+  std::mutex mutex;
+};
+
+
+SharedFixtureState::SharedFixtureState()
+: lock(new Lock)
+{ }
+
+
+SharedFixtureState::~SharedFixtureState()
+{
+  delete lock;
+}
+
+
+const Test *
+FixtureTimer::fixtureTest()
+{
+  return timedFixtureTest;
+}
+
+
+void *
+SharedFixtureState::acquire(const Test *test)
+{
+  std::lock_guard<std::mutex> guard(lock->mutex);
+  if (object == NULL)
+  {
+    FixtureTimer timer(FixtureTimer::Phase::setup);
+    object = create();
+  }
+  ++references;
+  if (test != NULL && FixtureGroups::instance().attach(*this, *test)) ++references;
+  return object;
+}
+
+
+void
+SharedFixtureState::release()
+{
+  std::lock_guard<std::mutex> guard(lock->mutex);
+  if (references == 0 || --references > 0) return;
+  FixtureTimer timer(FixtureTimer::Phase::teardown);
+  destroy(object);
+  object = NULL;
+}
+
+
+namespace {
+
+/**
+ * Holds the failures of one test until the runner replays them, in order,
+ * into the caller's TestResult.
+ */
+class BufferedResult : public TestResult
+{
+public:
+  void addFailure(const Failure &failure) override { failures.push_back(failure); }
+
+  void testsEnded() override { }
+
+  void replay(TestResult &target)
+  {
+    target.countChecks(checks(), failedChecks());
+    target.messages().adopt(std::move(messages()));
+    for (const Failure &failure : failures) target.addFailure(failure);
+  }
+
+private:
+  std::vector<Failure> failures;
+};
+
+
+/**
+ * One deque of test indices per worker.  A worker takes work from the
+ * front of its own deque and, once that is empty, steals from the back of
+ * the others.  Every deque has its own lock, so workers only contend while
+ * stealing.
+ */
+class WorkStealingQueues
+{
+public:
+  explicit WorkStealingQueues(unsigned int workers)
+  : queues(workers)
+  { }
+
+  void push(unsigned int worker, std::size_t task)
+  {
+    queues[worker].tasks.push_back(task);
+  }
+
+  bool pop(unsigned int worker, std::size_t &task)
+  {
+    if (takeFront(queues[worker], task)) return true;
+    for (std::size_t i = 1; i < queues.size(); ++i)
+    {
+      if (takeBack(queues[(worker + i) % queues.size()], task)) return true;
+    }
+    return false;
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex lock;
+    std::deque<std::size_t> tasks;
+  };
+
+  static bool takeFront(Queue &queue, std::size_t &task)
+  {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+  }
+
+  static bool takeBack(Queue &queue, std::size_t &task)
+  {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+  }
+
+  std::vector<Queue> queues;
+};
+
+
+typedef std::map<std::string, double> Durations;
+
+std::string
+qualifiedName(const Test &test)
+{
+  std::string name(test.group());
+  if (!name.empty()) name += '.';
+  return name.append(test.name());
+}
+
+
+double
+threadCpuSeconds()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec now;
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return static_cast<double>(now.tv_sec) + static_cast<double>(now.tv_nsec) * 1.0e-9;
+#else
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+
+#if defined(__linux__)
+/**
+ * The perf_event_open counters of one thread: a group of hardware events
+ * and a group of software events, each opened as a whole or not at all,
+ * and each enabled, disabled and read with one call.  Hardware events are
+ * commonly unavailable in containers and virtual machines; the software
+ * group still works there.
+ */
+class PerfCounters
+{
+public:
+  PerfCounters()
+  : owner(::getpid())
+  {
+    static const std::uint64_t hardwareEvents[] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+    };
+    static const std::uint64_t softwareEvents[] = {
+      PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS, PERF_COUNT_SW_CONTEXT_SWITCHES
+    };
+    open(hardware, PERF_TYPE_HARDWARE, hardwareEvents);
+    open(software, PERF_TYPE_SOFTWARE, softwareEvents);
+  }
+
+  ~PerfCounters()
+  {
+    for (int fd : hardware) ::close(fd);
+    for (int fd : software) ::close(fd);
+  }
+
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  /// The counters of the calling thread, reopened in a forked child,
+  /// where the inherited descriptors still count the parent.
+  static PerfCounters &
+  forThisThread()
+  {
+    thread_local std::unique_ptr<PerfCounters> counters;
+    if (!counters || counters->owner != ::getpid()) counters.reset(new PerfCounters);
+    return *counters;
+  }
+
+  void
+  start()
+  {
+    for (const std::vector<int> *group : { &hardware, &software })
+    {
+      if (group->empty()) continue;
+      ::ioctl(group->front(), PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ::ioctl(group->front(), PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+  }
+
+  PerfCounts
+  stop()
+  {
+    PerfCounts counts;
+    std::uint64_t values[4];
+    if (read(hardware, values))
+    {
+      counts.hardware = true;
+      counts.cycles = values[0];
+      counts.instructions = values[1];
+      counts.branchMisses = values[2];
+      counts.cacheMisses = values[3];
+    }
+    if (read(software, values))
+    {
+      counts.software = true;
+      counts.taskClockNanoseconds = values[0];
+      counts.pageFaults = values[1];
+      counts.contextSwitches = values[2];
+    }
+    return counts;
+  }
+
+private:
+  template<std::size_t count>
+  static void
+  open(std::vector<int> &group, std::uint32_t type, const std::uint64_t (&events)[count])
+  {
+    for (std::uint64_t event : events)
+    {
+      perf_event_attr attributes;
+      std::memset(&attributes, 0, sizeof attributes);
+      attributes.size = sizeof attributes;
+      attributes.type = type;
+      attributes.config = event;
+      attributes.disabled = group.empty();
+      // User space only, which perf_event_paranoid 2, the usual default, allows.
+      attributes.exclude_kernel = 1;
+      attributes.exclude_hv = 1;
+      attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      int leader = group.empty() ? -1 : group.front();
+      int fd = static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0, -1, leader, PERF_FLAG_FD_CLOEXEC));
+      if (fd < 0)
+      {
+        for (int opened : group) ::close(opened);
+        group.clear();
+        return;
+      }
+      group.push_back(fd);
+    }
+  }
+
+  static bool
+  read(const std::vector<int> &group, std::uint64_t *values)
+  {
+    if (group.empty()) return false;
+    ::ioctl(group.front(), PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    // nr, time enabled, time running, then one value per event.
+    std::uint64_t data[3 + 4];
+    ssize_t length = ::read(group.front(), data, (3 + group.size()) * sizeof data[0]);
+    if (length != static_cast<ssize_t>((3 + group.size()) * sizeof data[0]) || data[0] != group.size()) return false;
+    double scale = data[2] != 0 && data[2] < data[1] ? static_cast<double>(data[1]) / static_cast<double>(data[2]) : 1.0;
+    for (std::size_t i = 0; i < group.size(); ++i) values[i] = static_cast<std::uint64_t>(static_cast<double>(data[3 + i]) * scale);
+    return true;
+  }
+
+  pid_t owner;
+  std::vector<int> hardware;
+  std::vector<int> software;
+};
+#endif
+
+
+#if defined(__linux__)
+/// CPU time between two samples of a profiled thread.
+constexpr long sampleNanoseconds = 1000000;
+
+/**
+ * The stacks a thread samples while it runs a test, written by
+ * takeSample() into room allocated before the test starts, together with
+ * the bounds of the thread's stack.  A ring: when full, each sample
+ * replaces the oldest.
+ */
+struct SampleRing
+{
+  static constexpr int depth = 64;
+
+  /// Fewest and most samples a ring holds, about 128 KB and 8 MB.
+  static constexpr std::size_t minimumCapacity = 256;
+  static constexpr std::size_t maximumCapacity = 16384;
+
+  explicit SampleRing(std::size_t theCapacity)
+  : capacity(theCapacity),
+    frames(new void *[theCapacity * depth]),
+    depths(new int[theCapacity])
+  {
+    pthread_attr_t attributes;
+    if (::pthread_getattr_np(::pthread_self(), &attributes) != 0) return;
+    void *low = NULL;
+    std::size_t size = 0;
+    if (::pthread_attr_getstack(&attributes, &low, &size) == 0)
+    {
+      stackLow = reinterpret_cast<std::uintptr_t>(low);
+      stackHigh = stackLow + size;
+    }
+    ::pthread_attr_destroy(&attributes);
+  }
+
+  void **sample(std::size_t i) { return &frames[(i % capacity) * depth]; }
+  void *const *sample(std::size_t i) const { return &frames[(i % capacity) * depth]; }
+
+  const std::size_t capacity;
+  std::unique_ptr<void *[]> frames;
+  std::unique_ptr<int[]> depths;
+  std::uintptr_t stackLow = 0;
+  std::uintptr_t stackHigh = 0;
+  std::size_t head = 0;
+  volatile std::sig_atomic_t armed = 0;
+};
+
+thread_local SampleRing *sampleRing = NULL;
+
+
+/**
+ * Append to frames, after the taken already there, the return addresses
+ * of the frame pointer chain starting at framePointer, while the chain
+ * stays in the stack of ring's thread and climbs toward its base.  It
+ * only reads that stack, so unlike backtrace(), which may load libgcc or
+ * take the loader's lock, it is safe in a signal handler.  Functions
+ * built without frame pointers end the chain early or hide their callers;
+ * build the tests with -fno-omit-frame-pointer for whole stacks.
+ */
+int
+walkFrames(std::uintptr_t framePointer, void **frames, int taken, const SampleRing &ring)
+{
+  while (taken < SampleRing::depth && framePointer % sizeof(void *) == 0 &&
+         framePointer >= ring.stackLow && framePointer + 2 * sizeof(void *) <= ring.stackHigh)
+  {
+    void *const *frame = reinterpret_cast<void *const *>(framePointer);
+    if (frame[1] == NULL) break;
+    frames[taken++] = frame[1];
+    std::uintptr_t caller = reinterpret_cast<std::uintptr_t>(frame[0]);
+    if (caller <= framePointer) break;
+    framePointer = caller;
+  }
+  return taken;
+}
+
+
+/// Frames at the start of a sample that belong to takeSample(): none
+/// when it walks frame pointers, else itself and the signal trampoline.
+#if defined(__x86_64__) || defined(__aarch64__)
+constexpr int handlerFrames = 0;
+#else
+constexpr int handlerFrames = 2;
+#endif
+
+
+/**
+ * The SIGPROF handler: the interrupted address, then the frame pointer
+ * chain from the interrupted frame.  Elsewhere than x86-64 and AArch64 it
+ * falls back on backtrace(), which Profiler::start() runs once outside a
+ * handler, but which is not async-signal-safe: a sample taken while the
+ * thread is inside the dynamic loader may deadlock.
+ */
+void
+takeSample(int, siginfo_t *, void *context)
+{
+  int error = errno;
+  SampleRing *ring = sampleRing;
+  if (ring != NULL && ring->armed)
+  {
+    std::size_t slot = ring->head % ring->capacity;
+    void **frames = ring->sample(slot);
+#if defined(__x86_64__)
+    const mcontext_t &registers = static_cast<const ucontext_t *>(context)->uc_mcontext;
+    frames[0] = reinterpret_cast<void *>(registers.gregs[REG_RIP]);
+    ring->depths[slot] = walkFrames(static_cast<std::uintptr_t>(registers.gregs[REG_RBP]), frames, 1, *ring);
+#elif defined(__aarch64__)
+    const mcontext_t &registers = static_cast<const ucontext_t *>(context)->uc_mcontext;
+    frames[0] = reinterpret_cast<void *>(registers.pc);
+    ring->depths[slot] = walkFrames(static_cast<std::uintptr_t>(registers.regs[29]), frames, 1, *ring);
+#else
+    static_cast<void>(context);
+    ring->depths[slot] = ::backtrace(frames, SampleRing::depth);
+#endif
+    ++ring->head;
+  }
+  errno = error;
+}
+
+
+std::string
+demangled(const char *symbol)
+{
+#if defined(__GNUC__)
+  int status = 0;
+  char *name = abi::__cxa_demangle(symbol, NULL, NULL, &status);
+  if (status == 0 && name != NULL)
+  {
+    std::string result(name);
+    std::free(name);
+    return result;
+  }
+#endif
+  return symbol;
+}
+
+
+/**
+ * Names code addresses once the tests are done.  dladdr() finds the
+ * module holding an address; the module's symbol table, read from its
+ * file, names the function, as the dynamic symbols dladdr() knows
+ * leave out the functions a program does not export.
+ */
+class Symbolizer
+{
+public:
+  std::string
+  name(void *address)
+  {
+    Dl_info info;
+    if (::dladdr(address, &info) == 0 || info.dli_fbase == NULL)
+    {
+      char unknown[32];
+      std::snprintf(unknown, sizeof unknown, "%p", address);
+      return unknown;
+    }
+    Module &found = module(info);
+    std::uintptr_t offset = reinterpret_cast<std::uintptr_t>(address) - found.bias;
+    auto function = std::upper_bound(found.functions.begin(), found.functions.end(), offset,
+                                     [](std::uintptr_t value, const Function &candidate) { return value < candidate.start; });
+    if (function != found.functions.begin() && offset - (--function)->start < std::max<std::uintptr_t>(function->size, 1))
+    {
+      return demangled(std::string(function->name).c_str());
+    }
+    if (info.dli_sname != NULL) return demangled(info.dli_sname);
+    std::string_view file(info.dli_fname != NULL ? info.dli_fname : "");
+    char where[32];
+    std::snprintf(where, sizeof where, "+0x%zx", static_cast<std::size_t>(reinterpret_cast<std::uintptr_t>(address) -
+                                                                          reinterpret_cast<std::uintptr_t>(info.dli_fbase)));
+    return std::string(file.substr(file.find_last_of('/') + 1)).append(where);
+  }
+
+private:
+  struct Function
+  {
+    std::uintptr_t start;
+    std::uintptr_t size;
+    std::string_view name;  ///< in the mapped file
+  };
+
+  struct Module
+  {
+    MappedFile file;
+    std::uintptr_t bias = 0;
+    std::vector<Function> functions;
+  };
+
+  Module &
+  module(const Dl_info &info)
+  {
+    auto known = modules.find(info.dli_fbase);
+    if (known != modules.end()) return known->second;
+    Module &loaded = modules[info.dli_fbase];
+    if ((info.dli_fname == NULL || !loaded.file.open(info.dli_fname)) && !loaded.file.open("/proc/self/exe")) return loaded;
+
+    // Symbols of a shared object or position independent program are
+    // offsets from where it was loaded; those of any other, addresses.
+    std::span<const std::byte> bytes = loaded.file.bytes();
+    const ElfW(Ehdr) *header = reinterpret_cast<const ElfW(Ehdr) *>(bytes.data());
+    if (bytes.size() < sizeof(ElfW(Ehdr)) || std::memcmp(header->e_ident, ELFMAG, SELFMAG) != 0) return loaded;
+    if (header->e_type == ET_DYN) loaded.bias = reinterpret_cast<std::uintptr_t>(info.dli_fbase);
+    if (header->e_shoff == 0 || header->e_shoff + header->e_shnum * sizeof(ElfW(Shdr)) > bytes.size()) return loaded;
+    const ElfW(Shdr) *sections = reinterpret_cast<const ElfW(Shdr) *>(bytes.data() + header->e_shoff);
+    for (unsigned int type : { SHT_SYMTAB, SHT_DYNSYM })
+    {
+      for (unsigned int i = 0; i < header->e_shnum; ++i)
+      {
+        const ElfW(Shdr) &table = sections[i];
+        if (table.sh_type != type || table.sh_link >= header->e_shnum) continue;
+        const ElfW(Shdr) &strings = sections[table.sh_link];
+        if (table.sh_offset + table.sh_size > bytes.size() || strings.sh_offset + strings.sh_size > bytes.size()) continue;
+        const ElfW(Sym) *symbols = reinterpret_cast<const ElfW(Sym) *>(bytes.data() + table.sh_offset);
+        std::string_view names(reinterpret_cast<const char *>(bytes.data() + strings.sh_offset), strings.sh_size);
+        for (std::size_t j = 0; j < table.sh_size / sizeof(ElfW(Sym)); ++j)
+        {
+          const ElfW(Sym) &symbol = symbols[j];
+          if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC || symbol.st_value == 0 || symbol.st_name >= names.size()) continue;
+          std::string_view name = names.substr(symbol.st_name);
+          loaded.functions.push_back(Function{ symbol.st_value, symbol.st_size, name.substr(0, name.find('\0')) });
+        }
+      }
+      if (!loaded.functions.empty()) break;
+    }
+    std::sort(loaded.functions.begin(), loaded.functions.end(),
+              [](const Function &left, const Function &right) { return left.start < right.start; });
+    return loaded;
+  }
+
+  std::map<const void *, Module> modules;
+};
+#endif
+
+
+/**
+ * Collects the stacks sampled while each test ran as return addresses,
+ * and names them only in finish(), once the tests are done, so sampling
+ * costs no more than a walk of the frame pointers.
+ */
+class Profiler
+{
+public:
+  typedef std::map<std::vector<void *>, unsigned long> Stacks;
+
+  static Profiler &
+  instance()
+  {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  /// Start sampling, if theFileName is not empty, into rings sized from
+  /// the durations the tests had before.
+  void
+  start(const std::string &theFileName, const Durations &durations)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    fileName = theFileName;
+    tests.clear();
+    overwritten = 0;
+    expected.clear();
+    if (fileName.empty()) return;
+    expected = durations;
+#if defined(__linux__)
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    void *warm[4];
+    ::backtrace(warm, 4);
+#endif
+    struct sigaction action = {};
+    action.sa_sigaction = takeSample;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGPROF, &action, &previous);
+#else
+    throw std::runtime_error("--profile needs Linux");
+#endif
+  }
+
+  bool enabled() const { return !fileName.empty(); }
+
+#if defined(__linux__)
+  /// Room for twice the samples test took the last time it ran, or for a
+  /// second of CPU time if it has not run before.
+  std::size_t
+  samplesFor(const Test &test) const
+  {
+    auto duration = expected.find(qualifiedName(test));
+    double seconds = duration != expected.end() ? 2.0 * duration->second : 1.0;
+    double samples = std::ceil(seconds * 1e9 / static_cast<double>(sampleNanoseconds));
+    if (samples >= static_cast<double>(SampleRing::maximumCapacity)) return SampleRing::maximumCapacity;
+    return std::max(SampleRing::minimumCapacity, static_cast<std::size_t>(samples));
+  }
+#endif
+
+  void
+  add(const Test &test, const Stacks &stacks, unsigned long lost)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stacks &kept = tests[qualifiedName(test)];
+    for (const auto &stack : stacks) kept[stack.first] += stack.second;
+    overwritten += lost;
+  }
+
+  /// Write every test's stacks, root first, as "group.name;outer;...;inner count".
+  void
+  finish()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fileName.empty()) return;
+#if defined(__linux__)
+    // A test the watchdog gave up on may still have its timer running.
+    if (previous.sa_handler == SIG_DFL) ::signal(SIGPROF, SIG_IGN);
+    else ::sigaction(SIGPROF, &previous, NULL);
+    Symbolizer symbolizer;
+    std::map<void *, std::string> names;
+    std::ofstream out(fileName.c_str(), std::ios::out | std::ios::trunc);
+    for (const auto &test : tests)
+    {
+      // Stacks that differ only in where in a function they were become one.
+      std::map<std::string, unsigned long> folded;
+      for (const auto &stack : test.second)
+      {
+        std::string line(test.first);
+        for (void *frame : stack.first)
+        {
+          auto name = names.find(frame);
+          if (name == names.end())
+          {
+            // Return addresses are just past their calls; look up the call.
+            name = names.emplace(frame, frame == NULL ? std::string("[truncated]")
+                                                      : symbolizer.name(static_cast<char *>(frame) - 1)).first;
+          }
+          line.append(1, ';').append(name->second);
+        }
+        folded[line] += stack.second;
+      }
+      for (const auto &stack : folded) out << stack.first << ' ' << stack.second << '\n';
+    }
+    if (overwritten > 0) out << "[overwritten samples] " << overwritten << '\n';
+    if (!out) throw std::runtime_error("cannot write the profile to " + fileName);
+#endif
+    fileName.clear();
+  }
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+  friend void lockForFork();
+  friend void unlockAfterFork(bool inChild);
+#endif
+  std::mutex mutex;
+  std::string fileName;
+  std::map<std::string, Stacks> tests;
+  unsigned long overwritten = 0;
+  Durations expected;
+#if defined(__linux__)
+  struct sigaction previous = {};
+#endif
+};
+
+
+/**
+ * While Profiler::instance() is enabled, sample the stack of this
+ * thread every millisecond of its CPU time, from construction until
+ * stop(), and hand the stacks to the profiler without the frames of the
+ * handler or of whatever called the function constructing the scope.
+ */
+class ProfileScope
+{
+public:
+  explicit ProfileScope(const Test &theTest)
+  : test(theTest)
+  {
+#if defined(__linux__)
+    if (!Profiler::instance().enabled()) return;
+    // A thread keeps the largest ring it needed so far.
+    static thread_local std::unique_ptr<SampleRing> ring;
+    std::size_t wanted = Profiler::instance().samplesFor(test);
+    if (!ring || ring->capacity < wanted) ring.reset(new SampleRing(wanted));
+    sampleRing = ring.get();
+#if defined(__x86_64__) || defined(__aarch64__)
+    baseDepth = walkFrames(reinterpret_cast<std::uintptr_t>(__builtin_frame_address(0)), base, 0, *ring);
+#else
+    baseDepth = ::backtrace(base, SampleRing::depth);
+#endif
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+    sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = static_cast<pid_t>(::syscall(SYS_gettid));
+    if (::timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) return;
+    sampleRing->head = 0;
+    sampleRing->armed = 1;
+    itimerspec interval = { { 0, sampleNanoseconds }, { 0, sampleNanoseconds } };
+    ::timer_settime(timer, 0, &interval, NULL);
+    active = true;
+#endif
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+  ~ProfileScope() { stop(); }
+
+  void
+  stop()
+  {
+#if defined(__linux__)
+    if (!active) return;
+    active = false;
+    sampleRing->armed = 0;
+    ::timer_delete(timer);
+
+    Profiler::Stacks stacks;
+    const SampleRing &ring = *sampleRing;
+    std::size_t first = ring.head > ring.capacity ? ring.head - ring.capacity : 0;
+    for (std::size_t sample = first; sample < ring.head; ++sample)
+    {
+      void *const *frames = ring.sample(sample);
+      int depth = ring.depths[sample % ring.capacity];
+
+      // Outside the test are the frames shared with the base, and the one
+      // that made the scope, unless the sample ran out of room for them.
+      int inner = handlerFrames;
+      int outer = depth;
+      bool truncated = depth == SampleRing::depth;
+      if (!truncated)
+      {
+        int shared = 0;
+        while (shared < baseDepth && depth - shared > inner && frames[depth - 1 - shared] == base[baseDepth - 1 - shared]) ++shared;
+        outer = std::max(inner + 1, depth - shared - 1);
+      }
+      if (outer <= inner) continue;
+      std::vector<void *> stack;
+      stack.reserve(static_cast<std::size_t>(outer - inner) + 1);
+      if (truncated) stack.push_back(NULL);
+      for (int frame = outer - 1; frame >= inner; --frame) stack.push_back(frames[frame]);
+      ++stacks[stack];
+    }
+    Profiler::instance().add(test, stacks, first);
+#endif
+  }
+
+private:
+  const Test &test;
+  bool active = false;
+#if defined(__linux__)
+  timer_t timer = {};
+  void *base[SampleRing::depth];
+  int baseDepth = 0;
+#endif
+};
+
+
+/// Held while a result is replayed into the caller's TestResult from a
+/// thread other than the one that ran the test, so the watchdog can end
+/// the run between two tests' reports.
+std::mutex reportLock;
+
+/// Exit status of a worker process its watchdog ended, as timeout(1) has.
+constexpr int timedOutStatus = 124;
+
+
+#if defined(__linux__)
+/**
+ * The stack of one thread, written by dumpStack() when the watchdog asks
+ * every thread for its stack.
+ */
+struct ThreadStack
+{
+  pid_t thread;
+  int depth;
+  void *frames[SampleRing::depth];
+};
+
+constexpr int maxThreadStacks = 256;
+ThreadStack threadStacks[maxThreadStacks];
+std::atomic<int> threadStacksTaken;
+std::atomic<int> threadStacksWritten;
+
+/// The signal the watchdog asks each thread for its stack with.
+int
+dumpSignal()
+{
+  return SIGRTMIN;
+}
+
+/**
+ * The dumpSignal() handler.  It calls nothing but backtrace(), which
+ * Watchdog::start() has run once already.  backtrace() is not
+ * async-signal-safe: a thread interrupted inside the dynamic loader may
+ * never answer, which dumpThreads() waits for only a second, and only
+ * while the process is ending anyway.
+ */
+void
+dumpStack(int, siginfo_t *, void *)
+{
+  int error = errno;
+  int slot = threadStacksTaken.fetch_add(1);
+  if (slot < maxThreadStacks)
+  {
+    threadStacks[slot].thread = static_cast<pid_t>(::syscall(SYS_gettid));
+    threadStacks[slot].depth = ::backtrace(threadStacks[slot].frames, SampleRing::depth);
+  }
+  threadStacksWritten.fetch_add(1);
+  errno = error;
+}
+#endif
+
+
+/**
+ * Fails a test that runs longer than its timeout, and the run when it
+ * outlasts RunOptions::runTimeoutSeconds, from a thread of its own;
+ * timedRun() tells it which test each thread runs.  When time is up it
+ * writes the stacks of all threads to standard error.  A test cannot be
+ * stopped, so it then reports the overrun tests as failures, saves what
+ * the run keeps, and ends the run through TestResult::testsEnded() and
+ * exit(); in a worker process of an isolated run it ends the process with
+ * timedOutStatus instead, for IsolatedRun to report.  A forked child
+ * starts out with no watchdog thread and no tests running.
+ */
+class Watchdog
+{
+public:
+  typedef std::function<void(const Test &, const TestStats &)> Recorder;
+
+  static Watchdog &
+  instance()
+  {
+    static Watchdog watchdog;
+    return watchdog;
+  }
+
+  Watchdog()
+  : wakeup(new std::condition_variable),
+    started(false)
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    ::pthread_atfork(lockForFork, []() { unlockAfterFork(false); }, []() { unlockAfterFork(true); });
+#endif
+  }
+
+  /// Take the timeouts of a run of list, which starts now.
+  void
+  configure(const std::vector<Test *> &list, double theTestTimeout, double theRunTimeout)
+  {
+    testTimeout = theTestTimeout;
+    runTimeout = theRunTimeout;
+    runDeadline = runTimeout > 0.0 ? steadyNanoseconds() + static_cast<long long>(runTimeout * 1e9) : 0;
+    needed = testTimeout > 0.0 || runDeadline != 0;
+    for (const Test *test : list) needed = needed || test->timeout() > 0.0;
+  }
+
+  double timeoutOf(const Test &test) const { return test.timeout() > 0.0 ? test.timeout() : testTimeout; }
+
+  double runSeconds() const { return runTimeout; }
+
+  /// The steady clock nanoseconds the run must end by; zero for never.
+  long long deadline() const { return runDeadline; }
+
+  /// Start watching, if anything has a timeout, reporting to result, or
+  /// ending the process when result is null.  On a timeout, record is
+  /// told of each test failed and save keeps what the run has measured.
+  void
+  start(TestResult *theResult, Recorder theRecord = Recorder(), std::function<void()> theSave = std::function<void()>())
+  {
+    if (!needed || started.load()) return;
+    result = theResult;
+    record = theRecord;
+    save = theSave;
+    stopping = false;
+#if defined(__linux__)
+    void *warm[4];
+    ::backtrace(warm, 4);
+    struct sigaction action = {};
+    action.sa_sigaction = dumpStack;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(dumpSignal(), &action, NULL);
+#endif
+    watcher.reset(new std::thread([this]() { watch(); }));
+    started.store(true);
+  }
+
+  void
+  stop()
+  {
+    if (!started.load()) return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeup->notify_one();
+    watcher->join();
+    watcher.reset();
+    started.store(false);
+  }
+
+  bool watching() const { return started.load(); }
+
+  /// Have a timeout report, along with the tests it fails, the tests that
+  /// finished but wait to be reported, by calling flush with reportLock
+  /// held; an empty flush reports none.
+  void
+  flushWith(std::function<void()> theFlush)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    flush = theFlush;
+  }
+
+  void
+  enter(const Test &test)
+  {
+    double seconds = timeoutOf(test);
+    Watched watched = { &test, 0, steadyNanoseconds(), 0 };
+#if defined(__linux__)
+    watched.thread = static_cast<pid_t>(::syscall(SYS_gettid));
+#endif
+    if (seconds > 0.0) watched.deadline = watched.started + static_cast<long long>(seconds * 1e9);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!started.load()) return;
+    running.push_back(watched);
+    if (watched.deadline != 0) wakeup->notify_one();
+  }
+
+  void
+  leave(const Test &test)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto watched = std::find_if(running.begin(), running.end(), [&test](const Watched &candidate) { return candidate.test == &test; });
+    if (watched != running.end()) running.erase(watched);
+  }
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+  friend void lockForFork();
+  friend void unlockAfterFork(bool inChild);
+#endif
+  struct Watched
+  {
+    const Test *test;
+    long thread;
+    long long started;
+    long long deadline;  ///< zero for none
+  };
+
+  /// In the child of a fork(), holding mutex since before it: the
+  /// watcher, the condition it may wait on and the tests watched belong to
+  /// the parent.  Let the watcher and the condition go without destroying
+  /// them, as ConsoleWriter::forked() does, so that start() begins anew.
+  void
+  forked()
+  {
+    static_cast<void>(watcher.release());
+    static_cast<void>(wakeup.release());
+    wakeup.reset(new std::condition_variable);
+    started.store(false);
+    running.clear();
+    stopping = false;
+  }
+
+  void
+  watch()
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+      long long now = steadyNanoseconds();
+      long long next = runDeadline;
+      const Watched *overdue = NULL;
+      for (const Watched &watched : running)
+      {
+        if (watched.deadline != 0 && (next == 0 || watched.deadline < next))
+        {
+          next = watched.deadline;
+          overdue = &watched;
+        }
+      }
+      if (next != 0 && now >= next) expire(overdue);
+      if (next == 0) wakeup->wait(lock);
+      else wakeup->wait_for(lock, std::chrono::nanoseconds(next - now));
+    }
+  }
+
+  /// Report overdue, or with null every running test and the run, and end the process.
+  [[noreturn]] void
+  expire(const Watched *overdue)
+  {
+    long long now = steadyNanoseconds();
+    std::ostringstream stacks;
+    stacks << "Watchdog: ";
+    if (overdue != NULL) stacks << qualifiedName(*overdue->test) << " exceeded its timeout of " << timeoutOf(*overdue->test) << " s";
+    else stacks << "the run exceeded its timeout of " << runTimeout << " s";
+    stacks << "; the stacks of its threads follow.\n";
+    dumpThreads(stacks);
+    std::cout.flush();
+    std::cerr << stacks.str() << std::flush;
+    if (result == NULL)
+    {
+      std::fflush(NULL);
+      ::_exit(timedOutStatus);
+    }
+
+    std::lock_guard<std::mutex> reporting(reportLock);
+    bool reported = false;
+    for (const Watched &watched : running)
+    {
+      if (overdue != NULL && &watched != overdue) continue;
+      const Test &test = *watched.test;
+      MessageStream message(result->messages());
+      if (overdue != NULL) message << "exceeded its timeout of " << timeoutOf(test) << " s";
+      else message << "still running when the run exceeded its timeout of " << runTimeout << " s";
+      message << "; the stacks of all threads are on standard error";
+      TestStats stats;
+      stats.wallSeconds = static_cast<double>(now - watched.started) * 1e-9;
+      stats.failures = 1;
+      result->testStarted(test);
+      result->countChecks(0, 1);
+      result->addFailure(Failure(test.name(), test.file(), test.line(), message.finish()));
+      result->testEnded(test, stats);
+      if (record) record(test, stats);
+      reported = true;
+    }
+    if (!reported)
+    {
+      MessageStream message(result->messages());
+      message << "the run exceeded its timeout of " << runTimeout << " s";
+      result->addFailure(Failure(std::string_view(), "<unknown>", 0, message.finish()));
+    }
+    if (flush) flush();
+    try
+    {
+      if (save) save();
+    }
+    catch (const std::exception &ex)
+    {
+      std::cerr << "Watchdog: " << ex.what() << std::endl;
+    }
+    result->testsEnded();
+    std::cout.flush();
+    std::fflush(NULL);
+    std::_Exit(EXIT_FAILURE);
+  }
+
+  /// Write the stack of every other thread, innermost call first.
+  void
+  dumpThreads(std::ostream &out) const
+  {
+#if defined(__linux__)
+    pid_t self = static_cast<pid_t>(::syscall(SYS_gettid));
+    threadStacksTaken = 0;
+    threadStacksWritten = 0;
+    int asked = 0;
+    std::error_code error;
+    for (const auto &task : std::filesystem::directory_iterator("/proc/self/task", error))
+    {
+      pid_t thread = static_cast<pid_t>(std::atol(task.path().filename().c_str()));
+      if (thread != self && ::syscall(SYS_tgkill, ::getpid(), thread, dumpSignal()) == 0) ++asked;
+    }
+    long long patience = steadyNanoseconds() + 1000000000LL;
+    while (threadStacksWritten.load() < asked && steadyNanoseconds() < patience)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Symbolizer symbolizer;
+    int written = std::min(threadStacksWritten.load(), maxThreadStacks);
+    for (int i = 0; i < written; ++i)
+    {
+      const ThreadStack &stack = threadStacks[i];
+      out << "thread " << stack.thread;
+      for (const Watched &watched : running)
+      {
+        if (watched.thread == stack.thread) out << ", running " << qualifiedName(*watched.test);
+      }
+      out << ":\n";
+      // The first two frames are the handler and the signal trampoline.
+      for (int frame = 2; frame < stack.depth; ++frame)
+      {
+        out << "    " << symbolizer.name(static_cast<char *>(stack.frames[frame]) - 1) << '\n';
+      }
+    }
+    if (written < asked) out << asked - written << " threads did not answer\n";
+#else
+    out << "(stacks need Linux)\n";
+#endif
+  }
+
+  std::mutex mutex;
+  std::unique_ptr<std::condition_variable> wakeup;
+  std::unique_ptr<std::thread> watcher;
+  std::atomic<bool> started;  ///< whether watcher runs
+  bool stopping = false;
+  bool needed = false;
+  std::vector<Watched> running;
+  double testTimeout = 0.0;
+  double runTimeout = 0.0;
+  long long runDeadline = 0;
+  TestResult *result = NULL;
+  Recorder record;
+  std::function<void()> save;
+  std::function<void()> flush;
+};
+
+
+/// Has Watchdog::instance(), if watching, watch this thread run test while it lives.
+class WatchedTest
+{
+public:
+  explicit WatchedTest(const Test &theTest)
+  : test(theTest),
+    watched(Watchdog::instance().watching())
+  {
+    if (watched) Watchdog::instance().enter(test);
+  }
+
+  WatchedTest(const WatchedTest &) = delete;
+  WatchedTest &operator=(const WatchedTest &) = delete;
+
+  ~WatchedTest()
+  {
+    if (watched) Watchdog::instance().leave(test);
+  }
+
+private:
+  const Test &test;
+  bool watched;
+};
+
+
+/**
+ * Run test into result and measure it: two steady clock and two CPU clock
+ * reads, plus the counters result already keeps and the thread's
+ * allocation counts.  With counting, the thread's performance counters
+ * run around the test as well.  The time spent setting up and tearing
+ * down fixtures, including the shared fixtures of the test's group when
+ * it is the last of the group to end, is kept apart from the wall time.
+ */
+TestStats
+timedRun(Test &test, TestResult &result, bool counting = false)
+{
+  unsigned long checks = result.checks();
+  unsigned long failures = result.failedChecks();
+#if defined(__linux__)
+  PerfCounters *counters = counting ? &PerfCounters::forThisThread() : NULL;
+#endif
+  double cpuStart = threadCpuSeconds();
+  auto start = std::chrono::steady_clock::now();
+  AllocationScope allocations(0, 0);
+#if defined(__linux__)
+  if (counters != NULL) counters->start();
+#endif
+
+  fixtureSeconds[0] = fixtureSeconds[1] = 0.0;
+  WatchedTest watched(test);
+  ProfileScope profiled(test);
+  try
+  {
+    test.run(result);
+  }
+  catch (...)
+  {
+    FixtureGroups::instance().ended(test);
+    throw;
+  }
+  FixtureGroups::instance().ended(test);
+  profiled.stop();
+
+  TestStats stats;
+#if defined(__linux__)
+  if (counters != NULL) stats.counters = counters->stop();
+#endif
+  AllocationCounts used = allocations.used();
+  stats.allocations = used.allocations;
+  stats.allocatedBytes = used.bytes;
+  stats.liveAllocations = static_cast<long long>(used.allocations) - static_cast<long long>(used.deallocations);
+  stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  stats.cpuSeconds = threadCpuSeconds() - cpuStart;
+  stats.setupSeconds = fixtureSeconds[0];
+  stats.teardownSeconds = fixtureSeconds[1];
+  stats.wallSeconds = std::max(0.0, stats.wallSeconds - stats.setupSeconds - stats.teardownSeconds);
+  stats.checks = result.checks() - checks;
+  stats.failures = result.failedChecks() - failures;
+  return stats;
+}
+
+/// timedRun(), reporting an exception test lets escape as a failed check
+/// of it, so that the run goes on however it runs its tests.
+TestStats
+guardedRun(Test &test, TestResult &result, bool counting = false)
+{
+  unsigned long checks = result.checks();
+  unsigned long failures = result.failedChecks();
+  auto start = std::chrono::steady_clock::now();
+  double cpuStart = threadCpuSeconds();
+  try
+  {
+    return timedRun(test, result, counting);
+  }
+  catch (const std::exception &ex)
+  {
+    MessageStream message(result.messages());
+    message << "unhandled exception: " << ex.what();
+    result.countChecks(0, 1);
+    result.addFailure(Failure(test.name(), test.file(), test.line(), message.finish()));
+  }
+  catch (...)
+  {
+    result.countChecks(0, 1);
+    result.addFailure(Failure(test.name(), test.file(), test.line(), "unhandled non standard exception"));
+  }
+  // Timed up to the throw, so that the durations file keeps what the
+  // test took rather than nothing.
+  TestStats stats;
+  stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  stats.cpuSeconds = threadCpuSeconds() - cpuStart;
+  stats.checks = result.checks() - checks;
+  stats.failures = result.failedChecks() - failures;
+  return stats;
+}
+
+Durations
+readDurations(const std::string &fileName)
+{
+  Durations durations;
+  if (fileName.empty()) return durations;
+  std::ifstream in(fileName.c_str());
+  std::string name;
+  double seconds;
+  while (in >> name >> seconds) durations[name] = seconds;
+  return durations;
+}
+
+void
+writeDurations(const std::string &fileName, const Durations &durations)
+{
+  if (fileName.empty()) return;
+  std::ofstream out(fileName.c_str());
+  for (const auto &entry : durations) out << entry.first << ' ' << entry.second << '\n';
+}
+
+
+/// FNV-1a, continuing from hash.
+std::uint64_t
+hashBytes(std::span<const std::byte> bytes, std::uint64_t hash = 14695981039346656037ULL)
+{
+  for (std::byte value : bytes)
+  {
+    hash ^= static_cast<std::uint64_t>(value);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+
+std::uint64_t
+hashText(std::string_view text, std::uint64_t hash)
+{
+  // The terminating zero keeps "ab"+"c" apart from "a"+"bc".
+  return hashBytes(std::as_bytes(std::span<const char>(text.data(), text.size() + 1)), hash);
+}
+
+
+#if defined(__linux__)
+int
+findBuildId(dl_phdr_info *info, std::size_t, void *data)
+{
+  // The first object is the program itself, the only one wanted.
+  std::string &identity = *static_cast<std::string *>(data);
+  for (int i = 0; i < info->dlpi_phnum; ++i)
+  {
+    const ElfW(Phdr) &header = info->dlpi_phdr[i];
+    if (header.p_type != PT_NOTE) continue;
+    const char *note = reinterpret_cast<const char *>(info->dlpi_addr + header.p_vaddr);
+    const char *end = note + header.p_memsz;
+    while (note + sizeof(ElfW(Nhdr)) <= end)
+    {
+      const ElfW(Nhdr) *noteHeader = reinterpret_cast<const ElfW(Nhdr) *>(note);
+      const char *name = note + sizeof(ElfW(Nhdr));
+      const char *description = name + ((noteHeader->n_namesz + 3) & ~3u);
+      if (noteHeader->n_type == NT_GNU_BUILD_ID && noteHeader->n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0)
+      {
+        identity.assign(description, noteHeader->n_descsz);
+        return 1;
+      }
+      note = description + ((noteHeader->n_descsz + 3) & ~3u);
+    }
+  }
+  return 1;
+}
+#endif
+
+
+/**
+ * The GNU build ID of the test program, or else the device, inode, size
+ * and modification time of the program file, which a rebuild changes
+ * without the program having to be read; empty where neither can be had.
+ */
+std::string
+buildIdentity()
+{
+  std::string identity;
+#if defined(__linux__)
+  ::dl_iterate_phdr(findBuildId, &identity);
+  struct stat program;
+  if (identity.empty() && ::stat("/proc/self/exe", &program) == 0)
+  {
+    identity.append(std::to_string(program.st_dev)).append(1, ':').append(std::to_string(program.st_ino));
+    identity.append(1, ':').append(std::to_string(program.st_size));
+    identity.append(1, ':').append(std::to_string(program.st_mtim.tv_sec));
+    identity.append(1, '.').append(std::to_string(program.st_mtim.tv_nsec));
+  }
+#endif
+  return identity;
+}
+
+
+/**
+ * The outcome of each test the last time it ran, kept in the file of
+ * RunOptions::cacheFile as lines of key, pass or fail, and group.name.
+ * save() merges this run's outcomes into the file while holding a lock
+ * on the file PATH.lock, then renames a new file over it, so shards that
+ * share the file neither lose each other's outcomes nor read half of one.
+ */
+class ResultCache
+{
+public:
+  static ResultCache &
+  instance()
+  {
+    static ResultCache cache;
+    return cache;
+  }
+
+  void
+  load(const RunOptions &options)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    fileName = options.cacheFile;
+    entries.clear();
+    outcomes.clear();
+    keys.clear();
+    contents.clear();
+    if (fileName.empty()) return;
+    build = buildIdentity();
+    common = hashText(build, hashBytes({}));
+    for (const std::string &input : options.cacheInputs) common = hashInput(input, common);
+    read(entries);
+  }
+
+  bool enabled() const { return !fileName.empty(); }
+
+  /// Whether test passed the last time it ran, under the key it has now.
+  bool
+  passedBefore(const Test &test)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string name = qualifiedName(test);
+    std::uint64_t key = keys[name] = keyOf(test, name);
+    auto entry = entries.find(name);
+    return !build.empty() && entry != entries.end() && entry->second.passed && entry->second.key == key;
+  }
+
+  /// Whether test failed the last time it ran, under any key.
+  bool
+  failedBefore(const Test &test)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string name = qualifiedName(test);
+    keys[name] = keyOf(test, name);
+    auto entry = entries.find(name);
+    return entry != entries.end() && !entry->second.passed;
+  }
+
+  void
+  record(const Test &test, bool passed)
+  {
+    if (!enabled()) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string name = qualifiedName(test);
+    auto key = keys.find(name);
+    outcomes[name] = Entry{ key == keys.end() ? 0 : key->second, passed };
+  }
+
+  void
+  save()
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fileName.empty() || outcomes.empty()) return;
+#if defined(__unix__) || defined(__APPLE__)
+    int lockFd = ::open((fileName + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (lockFd >= 0) ::flock(lockFd, LOCK_EX);
+    std::string temporary = fileName + '.' + std::to_string(::getpid());
+#else
+    std::string temporary = fileName + ".new";
+#endif
+    std::map<std::string, Entry> merged;
+    read(merged);
+    for (const auto &outcome : outcomes) merged[outcome.first] = outcome.second;
+    {
+      std::ofstream out(temporary.c_str(), std::ios::out | std::ios::trunc);
+      out << "# key outcome group.name\n" << std::hex << std::setfill('0');
+      for (const auto &entry : merged)
+      {
+        out << std::setw(16) << entry.second.key << (entry.second.passed ? " pass " : " fail ") << entry.first << '\n';
+      }
+      out.flush();
+      if (!out) throw std::runtime_error("cannot write the result cache " + temporary);
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, fileName, error);
+#if defined(__unix__) || defined(__APPLE__)
+    if (lockFd >= 0) ::close(lockFd);
+#endif
+    if (error) throw std::runtime_error("cannot replace the result cache " + fileName + ": " + error.message());
+  }
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+  friend void lockForFork();
+  friend void unlockAfterFork(bool inChild);
+#endif
+  struct Entry
+  {
+    std::uint64_t key;
+    bool passed;
+  };
+
+  void
+  read(std::map<std::string, Entry> &into) const
+  {
+    std::ifstream in(fileName.c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream fields(line);
+      Entry entry;
+      std::string outcome;
+      std::string name;
+      if (fields >> std::hex >> entry.key >> outcome >> name)
+      {
+        entry.passed = outcome == "pass";
+        into[name] = entry;
+      }
+    }
+  }
+
+  std::uint64_t
+  keyOf(const Test &test, const std::string &name)
+  {
+    std::uint64_t key = hashText(name, common);
+    for (const std::string &input : test.inputs()) key = hashInput(input, key);
+    return key;
+  }
+
+  /// Mix the name and contents of the file path into hash.
+  std::uint64_t
+  hashInput(const std::string &path, std::uint64_t hash)
+  {
+    auto known = contents.find(path);
+    if (known == contents.end())
+    {
+      MappedFile input;
+      known = contents.emplace(path, input.open(path) ? hashBytes(input.bytes()) : 0).first;
+    }
+    hash = hashText(path, hash);
+    return hashBytes(std::as_bytes(std::span<const std::uint64_t>(&known->second, 1)), hash);
+  }
+
+  std::mutex mutex;
+  std::string fileName;
+  std::string build;
+  std::uint64_t common = 0;
+  std::map<std::string, Entry> entries;
+  std::map<std::string, Entry> outcomes;
+  std::map<std::string, std::uint64_t> keys;
+  std::map<std::string, std::uint64_t> contents;
+};
+
+
+/// Keep how long test took, and whether it passed, for later runs.
+void
+recordRun(Durations &durations, const Test &test, const TestStats &stats)
+{
+  durations[qualifiedName(test)] = stats.wallSeconds;
+  ResultCache::instance().record(test, stats.failures == 0);
+}
+
+
+/**
+ * Buffers the results of a list of tests that finish in any order and
+ * replays them into the caller's result in list order.  Whoever finishes
+ * the test at the commit cursor replays every consecutive finished test.
+ * A watchdog ending the run replays the rest of the finished tests with
+ * flush().
+ */
+class OrderedReport
+{
+public:
+  OrderedReport(const std::vector<Test *> &theTests, TestResult &theResult, Durations &theDurations)
+  : tests(theTests),
+    result(theResult),
+    durations(theDurations),
+    slots(theTests.size()),
+    committed(0)
+  {
+    Watchdog::instance().flushWith([this]() { flush(); });
+  }
+
+  OrderedReport(const OrderedReport &) = delete;
+  OrderedReport &operator=(const OrderedReport &) = delete;
+
+  ~OrderedReport()
+  {
+    Watchdog::instance().flushWith(std::function<void()>());
+  }
+
+  BufferedResult &buffer(std::size_t task) { return slots[task].buffer; }
+
+  void finish(std::size_t task, const TestStats &stats)
+  {
+    std::lock_guard<std::mutex> guard(reportLock);
+    slots[task].done = true;
+    slots[task].stats = stats;
+    for (; committed < slots.size() && slots[committed].done; ++committed)
+    {
+      const Test &test = *tests[committed];
+      result.testStarted(test);
+      slots[committed].buffer.replay(result);
+      result.testEnded(test, slots[committed].stats);
+      recordRun(durations, test, slots[committed].stats);
+    }
+  }
+
+  /// With reportLock held, replay every finished test not yet replayed,
+  /// skipping those still running, and replay nothing after.
+  void flush()
+  {
+    for (std::size_t task = committed; task < slots.size(); ++task)
+    {
+      if (!slots[task].done) continue;
+      const Test &test = *tests[task];
+      result.testStarted(test);
+      slots[task].buffer.replay(result);
+      result.testEnded(test, slots[task].stats);
+      recordRun(durations, test, slots[task].stats);
+    }
+    committed = slots.size();
+  }
+
+private:
+  struct Slot
+  {
+    Slot() : done(false) { }
+
+    BufferedResult buffer;
+    bool done;
+    TestStats stats;
+  };
+
+  const std::vector<Test *> &tests;
+  TestResult &result;
+  Durations &durations;
+  std::vector<Slot> slots;
+  std::size_t committed;
+};
+
+
+/**
+ * Runs a list of tests on a pool of threads.  Tests with a known duration
+ * are dealt longest first to the least loaded worker; the rest follow
+ * round robin in list order.
+ */
+class ParallelRun
+{
+public:
+  ParallelRun(const std::vector<Test *> &theTests, TestResult &theResult, Durations &theDurations, bool theCounting)
+  : tests(theTests),
+    counting(theCounting),
+    durations(theDurations),
+    report(theTests, theResult, theDurations)
+  { }
+
+  void run(unsigned int jobs)
+  {
+    WorkStealingQueues queues(jobs);
+    schedule(queues, jobs);
+
+    std::vector<std::thread> workers;
+    for (unsigned int worker = 0; worker < jobs; ++worker)
+    {
+      workers.emplace_back([this, &queues, worker]() { work(queues, worker); });
+    }
+    for (std::thread &worker : workers) worker.join();
+  }
+
+private:
+  void schedule(WorkStealingQueues &queues, unsigned int jobs)
+  {
+    std::vector<std::size_t> timed;
+    std::vector<std::size_t> untimed;
+    for (std::size_t i = 0; i < tests.size(); ++i)
+    {
+      (durations.count(qualifiedName(*tests[i])) != 0 ? timed : untimed).push_back(i);
+    }
+    std::vector<double> expected(tests.size(), 0.0);
+    for (std::size_t task : timed) expected[task] = durations[qualifiedName(*tests[task])];
+    std::stable_sort(timed.begin(), timed.end(), [&expected](std::size_t a, std::size_t b) {
+      return expected[a] > expected[b];
+    });
+
+    std::vector<double> load(jobs, 0.0);
+    for (std::size_t task : timed)
+    {
+      unsigned int worker = static_cast<unsigned int>(std::min_element(load.begin(), load.end()) - load.begin());
+      load[worker] += expected[task];
+      queues.push(worker, task);
+    }
+    for (std::size_t i = 0; i < untimed.size(); ++i) queues.push(i % jobs, untimed[i]);
+  }
+
+  void work(WorkStealingQueues &queues, unsigned int worker)
+  {
+    std::size_t task;
+    while (queues.pop(worker, task))
+    {
+      TestStats stats = guardedRun(*tests[task], report.buffer(task), counting);
+      report.finish(task, stats);
+    }
+  }
+
+  const std::vector<Test *> &tests;
+  bool counting;
+  Durations &durations;
+  OrderedReport report;
+};
+
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Records sent from an isolated worker process to the parent.  Both ends
+ * run the same binary, so the header travels as raw bytes, followed by
+ * the file name and message of a failure.
+ */
+struct RecordHeader
+{
+  enum Type : std::uint32_t { started, failed, ended };
+
+  std::uint32_t type;
+  std::uint32_t test;
+  std::uint32_t lineNumber;
+  std::uint32_t fileNameLength;
+  std::uint32_t messageLength;
+  TestStats stats;
+};
+
+void
+sendRecord(int fd, RecordHeader header, std::string_view fileName = std::string_view(), std::string_view message = std::string_view())
+{
+  header.fileNameLength = static_cast<std::uint32_t>(fileName.size());
+  header.messageLength = static_cast<std::uint32_t>(message.size());
+  std::string record(reinterpret_cast<const char *>(&header), sizeof header);
+  record += fileName;
+  record += message;
+  if (!writeFully(fd, record.data(), record.size())) ::_exit(EXIT_FAILURE);
+}
+
+
+/**
+ * The TestResult of a worker process: streams every failure to the parent.
+ */
+class PipeResult : public TestResult
+{
+public:
+  PipeResult(int theFd, std::size_t theTest) : fd(theFd), test(theTest) { }
+
+  void addFailure(const Failure &failure) override
+  {
+    RecordHeader header = { RecordHeader::failed, static_cast<std::uint32_t>(test), failure.lineNumber, 0, 0, TestStats() };
+    sendRecord(fd, header, failure.fileName, failure.message);
+  }
+
+  void testsEnded() override { }
+
+private:
+  int fd;
+  std::size_t test;
+};
+
+
+/**
+ * Runs a list of tests in forked worker processes, each owning a round
+ * robin slice of the list.  Workers stream their records back over a
+ * pipe.  When a worker dies inside a test, that test fails and a fresh
+ * worker continues with the rest of the slice.  Each worker has its own
+ * watchdog, which ends it when a test overruns; once the run is out of
+ * time the tests still to run fail without running.
+ */
+class IsolatedRun
+{
+public:
+  IsolatedRun(const std::vector<Test *> &theTests, TestResult &theResult, Durations &theDurations, bool theCounting)
+  : tests(theTests),
+    counting(theCounting),
+    report(theTests, theResult, theDurations)
+  { }
+
+  void run(unsigned int jobs)
+  {
+    workers.resize(jobs);
+    for (std::size_t i = 0; i < tests.size(); ++i) workers[i % jobs].pending.push_back(i);
+    for (Worker &worker : workers) spawn(worker);
+
+    std::vector<pollfd> fds;
+    for (;;)
+    {
+      fds.clear();
+      for (const Worker &worker : workers)
+      {
+        if (worker.fd >= 0) fds.push_back(pollfd{ worker.fd, POLLIN, 0 });
+      }
+      if (fds.empty()) break;
+      if (::poll(fds.data(), fds.size(), backstop(workers)) < 0 && errno != EINTR) throw std::runtime_error("poll failed");
+
+      for (Worker &worker : workers)
+      {
+        if (worker.fd >= 0) drain(worker);
+      }
+    }
+  }
+
+private:
+  struct Worker
+  {
+    Worker() : pid(-1), fd(-1), current(noTest) { }
+
+    std::deque<std::size_t> pending;
+    pid_t pid;
+    int fd;
+    std::size_t current;
+    std::chrono::steady_clock::time_point started;
+    std::string input;
+  };
+
+  static constexpr std::size_t noTest = static_cast<std::size_t>(-1);
+
+  /// How long poll() may wait: until a while after the run's deadline, by
+  /// when the workers' watchdogs should have ended them.  Kills the
+  /// workers still there after that.
+  static int backstop(const std::vector<Worker> &workers)
+  {
+    long long deadline = Watchdog::instance().deadline();
+    if (deadline == 0) return -1;
+    long long left = deadline + 5000000000LL - steadyNanoseconds();
+    if (left > 0) return static_cast<int>(std::min<long long>((left + 999999) / 1000000, std::numeric_limits<int>::max()));
+    for (const Worker &worker : workers)
+    {
+      if (worker.fd >= 0) ::kill(worker.pid, SIGKILL);
+    }
+    return -1;
+  }
+
+  void spawn(Worker &worker)
+  {
+    if (worker.pending.empty()) return;
+
+    // Close on exec, so that programs the tests start do not hold it open.
+    int channel[2];
+#if defined(__linux__)
+    if (::pipe2(channel, O_CLOEXEC) != 0) throw std::runtime_error("cannot create a pipe to a worker");
+#else
+    if (::pipe(channel) != 0) throw std::runtime_error("cannot create a pipe to a worker");
+    ::fcntl(channel[0], F_SETFD, FD_CLOEXEC);
+    ::fcntl(channel[1], F_SETFD, FD_CLOEXEC);
+#endif
+    console().drain();
+    std::cout.flush();
+    std::cerr.flush();
+    std::fflush(NULL);
+
+    pid_t pid = ::fork();
+    if (pid < 0) throw std::runtime_error("cannot fork a worker");
+    if (pid == 0)
+    {
+      // Nor does the worker keep the pipes of the other workers.
+      ::close(channel[0]);
+      for (const Worker &other : workers)
+      {
+        if (other.fd >= 0) ::close(other.fd);
+      }
+      work(channel[1], worker.pending);
+    }
+    ::close(channel[1]);
+    worker.pid = pid;
+    worker.fd = channel[0];
+    worker.current = noTest;
+    worker.input.clear();
+  }
+
+  [[noreturn]] void work(int fd, const std::deque<std::size_t> &slice)
+  {
+    Watchdog::instance().start(NULL);
+    for (std::size_t task : slice)
+    {
+      RecordHeader header = { RecordHeader::started, static_cast<std::uint32_t>(task), 0, 0, 0, TestStats() };
+      sendRecord(fd, header);
+      PipeResult result(fd, task);
+      header.stats = guardedRun(*tests[task], result, counting);
+      header.type = RecordHeader::ended;
+      sendRecord(fd, header);
+    }
+    std::cout.flush();
+    std::fflush(NULL);
+    ::_exit(EXIT_SUCCESS);
+  }
+
+  void drain(Worker &worker)
+  {
+    char chunk[65536];
+    ssize_t received = ::read(worker.fd, chunk, sizeof chunk);
+    if (received < 0 && errno == EINTR) return;
+    if (received > 0)
+    {
+      worker.input.append(chunk, static_cast<std::size_t>(received));
+      parse(worker);
+      return;
+    }
+    reap(worker);
+  }
+
+  void parse(Worker &worker)
+  {
+    std::size_t offset = 0;
+    while (worker.input.size() - offset >= sizeof(RecordHeader))
+    {
+      RecordHeader header;
+      std::memcpy(&header, worker.input.data() + offset, sizeof header);
+      std::size_t length = sizeof header + header.fileNameLength + header.messageLength;
+      if (worker.input.size() - offset < length) break;
+
+      const char *text = worker.input.data() + offset + sizeof header;
+      switch (header.type)
+      {
+      case RecordHeader::started:
+        worker.current = header.test;
+        worker.started = std::chrono::steady_clock::now();
+        break;
+      case RecordHeader::failed:
+      {
+        BufferedResult &buffer = report.buffer(header.test);
+        buffer.countChecks(0, 1);
+        buffer.addFailure(Failure(tests[header.test]->name(),
+                                  buffer.messages().store(std::string_view(text, header.fileNameLength)),
+                                  header.lineNumber,
+                                  buffer.messages().store(std::string_view(text + header.fileNameLength, header.messageLength))));
+        break;
+      }
+      case RecordHeader::ended:
+        worker.pending.pop_front();
+        worker.current = noTest;
+        report.finish(header.test, header.stats);
+        break;
+      }
+      offset += length;
+    }
+    worker.input.erase(0, offset);
+  }
+
+  void reap(Worker &worker)
+  {
+    ::close(worker.fd);
+    worker.fd = -1;
+    int status = 0;
+    while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) { }
+
+    const Watchdog &watchdog = Watchdog::instance();
+    bool late = watchdog.deadline() != 0 && steadyNanoseconds() >= watchdog.deadline();
+    if (worker.current != noTest)
+    {
+      std::ostringstream message;
+      bool timedOut = WIFEXITED(status) && WEXITSTATUS(status) == timedOutStatus;
+      if (late) message << "still running when the run exceeded its timeout of " << watchdog.runSeconds() << " s";
+      else if (timedOut) message << "exceeded its timeout of " << watchdog.timeoutOf(*tests[worker.current]) << " s";
+      else if (WIFSIGNALED(status)) message << "test crashed with signal " << WTERMSIG(status) << " (" << ::strsignal(WTERMSIG(status)) << ")";
+      else message << "test ended its process with exit status " << WEXITSTATUS(status);
+      if (late || timedOut) message << "; the stacks of its process's threads are on standard error";
+      BufferedResult &buffer = report.buffer(worker.current);
+      buffer.countChecks(0, 1);
+      const Test &test = *tests[worker.current];
+      buffer.addFailure(Failure(test.name(), test.file(), test.line(), buffer.messages().store(message.str())));
+      TestStats stats;
+      stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - worker.started).count();
+      stats.failures = 1;
+      report.finish(worker.current, stats);
+      worker.pending.pop_front();
+    }
+    for (; late && !worker.pending.empty(); worker.pending.pop_front())
+    {
+      std::ostringstream message;
+      message << "not run, as the run exceeded its timeout of " << watchdog.runSeconds() << " s";
+      BufferedResult &buffer = report.buffer(worker.pending.front());
+      buffer.countChecks(0, 1);
+      const Test &test = *tests[worker.pending.front()];
+      buffer.addFailure(Failure(test.name(), test.file(), test.line(), buffer.messages().store(message.str())));
+      TestStats stats;
+      stats.failures = 1;
+      report.finish(worker.pending.front(), stats);
+    }
+    spawn(worker);
+  }
+
+  const std::vector<Test *> &tests;
+  bool counting;
+  OrderedReport report;
+  std::vector<Worker> workers;
+};
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+/**
+ * Hold every lock of the runner across fork(), in the order the runner
+ * nests them, so that a child forked while other threads run tests, as a
+ * test of the runner or of forking code may be, does not inherit one held
+ * by a thread it lacks.  SharedFixture locks, held only while a fixture is
+ * set up, are not among them.
+ */
+void
+lockForFork()
+{
+  FixtureGroups::instance().mutex.lock();
+  Watchdog::instance().mutex.lock();
+  reportLock.lock();
+  ResultCache::instance().mutex.lock();
+  Baselines::instance().mutex.lock();
+  Profiler::instance().mutex.lock();
+}
+
+void
+unlockAfterFork(bool inChild)
+{
+  if (inChild) Watchdog::instance().forked();
+  Profiler::instance().mutex.unlock();
+  Baselines::instance().mutex.unlock();
+  ResultCache::instance().mutex.unlock();
+  reportLock.unlock();
+  Watchdog::instance().mutex.unlock();
+  FixtureGroups::instance().mutex.unlock();
+}
+#endif
+
+} // namespace
+
+
+namespace {
+
+/**
+ * Match test names, group.name, against the patterns of --filter or
+ * --exclude: comma separated globs or one regular expression.
+ */
+class NamePatterns
+{
+public:
+  explicit NamePatterns(const std::vector<std::string> &specifications)
+  {
+    for (const std::string &specification : specifications)
+    {
+      if (specification.size() > 1 && specification.front() == '/' && specification.back() == '/')
+      {
+        expressions.emplace_back(specification.substr(1, specification.size() - 2), std::regex::ECMAScript | std::regex::optimize);
+        continue;
+      }
+      std::size_t start = 0;
+      for (std::size_t comma = 0; comma != std::string::npos; start = comma + 1)
+      {
+        comma = specification.find(',', start);
+        std::string glob = specification.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (glob.empty()) continue;
+        (glob.find_first_of("*?") == std::string::npos ? names : globs).push_back(glob);
+      }
+    }
+  }
+
+  bool empty() const { return names.empty() && globs.empty() && expressions.empty(); }
+
+  bool matches(const TestInfo &info, std::string &scratch) const
+  {
+    // Plain names, the usual way to pick out one test, compare in place.
+    for (const std::string &name : names)
+    {
+      if (info.group.empty() ? name == info.name : name.size() == info.group.size() + 1 + info.name.size() &&
+                                                   name.compare(0, info.group.size(), info.group) == 0 &&
+                                                   name[info.group.size()] == '.' &&
+                                                   name.compare(info.group.size() + 1, std::string::npos, info.name) == 0)
+      {
+        return true;
+      }
+    }
+    if (globs.empty() && expressions.empty()) return false;
+
+    scratch.assign(info.group);
+    if (!scratch.empty()) scratch += '.';
+    scratch.append(info.name);
+    for (const std::string &glob : globs)
+    {
+      if (globMatch(glob, scratch)) return true;
+    }
+    for (const std::regex &expression : expressions)
+    {
+      if (std::regex_search(scratch, expression)) return true;
+    }
+    return false;
+  }
+
+private:
+  static bool globMatch(std::string_view pattern, std::string_view text)
+  {
+    // Iterative, backtracking only to the last star: linear for one star.
+    std::size_t p = 0, t = 0, star = std::string_view::npos, resume = 0;
+    while (t < text.size())
+    {
+      if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t]))
+      {
+        ++p;
+        ++t;
+      }
+      else if (p < pattern.size() && pattern[p] == '*')
+      {
+        star = p++;
+        resume = t;
+      }
+      else if (star != std::string_view::npos)
+      {
+        p = star + 1;
+        t = ++resume;
+      }
+      else return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+  }
+
+  std::vector<std::string> names;
+  std::vector<std::string> globs;
+  std::vector<std::regex> expressions;
+};
+
+
+} // namespace
+
+
+void
+ConcurrentTest::configure(bool pinThreads, unsigned int theYieldOneIn)
+{
+  pinned = pinThreads;
+  yieldOneIn = theYieldOneIn;
+}
+
+
+void
+ConcurrentTest::yieldSometimes()
+{
+  // xorshift, seeded apart on every thread
+  thread_local std::uint64_t state = 0x9E3779B97F4A7C15ULL ^ reinterpret_cast<std::uintptr_t>(&state);
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  if (state % yieldOneIn == 0) std::this_thread::yield();
+}
+
+
+void
+ConcurrentTest::run(TestResult &result)
+{
+#if defined(__linux__)
+  std::vector<int> cpus;
+  cpu_set_t allowed;
+  if (pinned && ::sched_getaffinity(0, sizeof allowed, &allowed) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+      if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+    }
+  }
+#endif
+
+  std::vector<BufferedResult> buffers(threadCount);
+  std::vector<long long> started(threadCount), finished(threadCount);
+  std::latch ready(threadCount);
+  std::vector<std::thread> workers;
+  workers.reserve(threadCount);
+  for (unsigned int index = 0; index < threadCount; ++index)
+  {
+    workers.emplace_back([&, index]() {
+#if defined(__linux__)
+      if (!cpus.empty())
+      {
+        cpu_set_t cpu;
+        CPU_ZERO(&cpu);
+        CPU_SET(cpus[index % cpus.size()], &cpu);
+        ::sched_setaffinity(0, sizeof cpu, &cpu);
+      }
+#endif
+      ready.arrive_and_wait();
+      started[index] = steadyNanoseconds();
+      try
+      {
+        work(buffers[index], index);
+      }
+      catch (const std::exception &ex)
+      {
+        MessageStream message(buffers[index].messages());
+        message << "unhandled exception in thread " << index << ": " << ex.what();
+        buffers[index].countChecks(0, 1);
+        buffers[index].addFailure(Failure(name(), file(), line(), message.finish()));
+      }
+      catch (...)
+      {
+        buffers[index].countChecks(0, 1);
+        buffers[index].addFailure(Failure(name(), file(), line(), "unhandled non standard exception"));
+      }
+      finished[index] = steadyNanoseconds();
+    });
+  }
+  for (std::thread &worker : workers) worker.join();
+  for (BufferedResult &buffer : buffers) buffer.replay(result);
+
+  std::vector<double> rates(threadCount);
+  for (unsigned int index = 0; index < threadCount; ++index)
+  {
+    long long elapsed = std::max(finished[index] - started[index], 1LL);
+    rates[index] = static_cast<double>(iterationCount) * 1.0e9 / static_cast<double>(elapsed);
+  }
+  ThroughputStats stats;
+  stats.name = name();
+  stats.threads = threadCount;
+  stats.iterations = iterationCount;
+  if (threadCount > 0)
+  {
+    long long first = *std::min_element(started.begin(), started.end());
+    long long last = *std::max_element(finished.begin(), finished.end());
+    stats.seconds = static_cast<double>(last - first) * 1.0e-9;
+  }
+  stats.opsPerSecond = rates;
+  result.addThroughput(stats);
+}
+
+
+namespace {
+
+/**
+ * Resumes the coroutines of asynchronous tests on one thread as what
+ * they await comes about: timers from an ordered map, file descriptors
+ * through epoll on Linux and poll() elsewhere, and conditions by testing
+ * them every millisecond.
+ */
+class EventLoop
+{
+public:
+  EventLoop()
+  {
+#if defined(__linux__)
+    epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) throw std::runtime_error(std::string("epoll_create1: ") + std::strerror(errno));
+#endif
+    previous = running;
+    running = this;
+  }
+
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  ~EventLoop()
+  {
+    running = previous;
+#if defined(__linux__)
+    ::close(epollFd);
+#endif
+  }
+
+  /// The loop running on this thread, if any.
+  static EventLoop *current() { return running; }
+
+  void schedule(std::coroutine_handle<> coroutine) { ready.push_back(coroutine); }
+
+  void wait(const AsyncWait &wait, std::coroutine_handle<> coroutine)
+  {
+    switch (wait.kind)
+    {
+    case AsyncWait::Kind::time: timers.emplace(wait.deadline, coroutine); break;
+    case AsyncWait::Kind::condition: conditions.emplace_back(wait, coroutine); break;
+    case AsyncWait::Kind::readable: files[wait.fd].readers.push_back(coroutine); update(wait.fd); break;
+    case AsyncWait::Kind::writable: files[wait.fd].writers.push_back(coroutine); update(wait.fd); break;
+    }
+  }
+
+  /**
+   * Resume coroutines until outstanding drops to zero.  Returns false if
+   * it stalls first, with nothing ready and nothing left to wait for.
+   */
+  bool run(const std::size_t &outstanding)
+  {
+    while (outstanding > 0)
+    {
+      while (!ready.empty())
+      {
+        std::coroutine_handle<> coroutine = ready.front();
+        ready.pop_front();
+        coroutine.resume();
+      }
+      if (outstanding == 0) break;
+
+      long long now = steadyNanoseconds();
+      while (!timers.empty() && timers.begin()->first <= now)
+      {
+        ready.push_back(timers.begin()->second);
+        timers.erase(timers.begin());
+      }
+      for (std::size_t i = 0; i < conditions.size();)
+      {
+        if (conditions[i].first.isReady(conditions[i].first.subject))
+        {
+          ready.push_back(conditions[i].second);
+          conditions.erase(conditions.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        else ++i;
+      }
+      if (!ready.empty()) continue;
+      if (timers.empty() && files.empty() && conditions.empty()) return false;
+
+      int timeout = -1;
+      if (!timers.empty()) timeout = static_cast<int>((timers.begin()->first - now + 999999) / 1000000);
+      if (!conditions.empty() && (timeout < 0 || timeout > 1)) timeout = 1;
+      waitForFiles(timeout);
+    }
+    return true;
+  }
+
+private:
+  /// Every coroutine waiting on a file, in the order they began to wait,
+  /// since tests sharing the loop may wait on the same one.
+  struct Waiters
+  {
+    std::vector<std::coroutine_handle<>> readers;
+    std::vector<std::coroutine_handle<>> writers;
+    bool watched = false;
+
+    /// Make ready every reader, if readable, and every writer, if writable.
+    void wake(std::deque<std::coroutine_handle<>> &ready, bool readable, bool writable)
+    {
+      if (readable)
+      {
+        ready.insert(ready.end(), readers.begin(), readers.end());
+        readers.clear();
+      }
+      if (writable)
+      {
+        ready.insert(ready.end(), writers.begin(), writers.end());
+        writers.clear();
+      }
+    }
+  };
+
+  /// Watch fd for what its waiters wait for, or stop watching it.
+  void update(int fd)
+  {
+    Waiters &waiters = files[fd];
+#if defined(__linux__)
+    epoll_event event = {};
+    event.events = (waiters.readers.empty() ? 0u : EPOLLIN) | (waiters.writers.empty() ? 0u : EPOLLOUT);
+    event.data.fd = fd;
+    int status = 0;
+    if (event.events == 0) status = waiters.watched ? ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL) : 0;
+    else status = ::epoll_ctl(epollFd, waiters.watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+    if (status != 0 && event.events != 0)
+    {
+      // Such as a regular file, which epoll refuses because it is always ready.
+      waiters.wake(ready, true, true);
+      event.events = 0;
+    }
+    waiters.watched = event.events != 0;
+    if (!waiters.watched) files.erase(fd);
+#else
+    if (waiters.readers.empty() && waiters.writers.empty()) files.erase(fd);
+#endif
+  }
+
+  void waitForFiles(int timeout)
+  {
+#if defined(__linux__)
+    epoll_event events[64];
+    int count = ::epoll_wait(epollFd, events, 64, timeout);
+    for (int i = 0; i < count; ++i) wake(events[i].data.fd, events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR),
+                                         events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR));
+#elif defined(__unix__) || defined(__APPLE__)
+    std::vector<pollfd> polled;
+    for (const auto &file : files)
+    {
+      short events = static_cast<short>((file.second.readers.empty() ? 0 : POLLIN) | (file.second.writers.empty() ? 0 : POLLOUT));
+      pollfd entry = { file.first, events, 0 };
+      polled.push_back(entry);
+    }
+    if (::poll(polled.data(), static_cast<nfds_t>(polled.size()), timeout) <= 0) return;
+    for (const pollfd &entry : polled)
+    {
+      wake(entry.fd, entry.revents & (POLLIN | POLLHUP | POLLERR), entry.revents & (POLLOUT | POLLHUP | POLLERR));
+    }
+#else
+    if (timeout > 0) std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+#endif
+  }
+
+  void wake(int fd, bool readable, bool writable)
+  {
+    auto file = files.find(fd);
+    if (file == files.end()) return;
+    file->second.wake(ready, readable, writable);
+    update(fd);
+  }
+
+  static thread_local EventLoop *running;
+
+  EventLoop *previous;
+  std::deque<std::coroutine_handle<>> ready;
+  std::multimap<long long, std::coroutine_handle<>> timers;
+  std::vector<std::pair<AsyncWait, std::coroutine_handle<>>> conditions;
+  std::map<int, Waiters> files;
+#if defined(__linux__)
+  int epollFd;
+#endif
+};
+
+thread_local EventLoop *EventLoop::running = NULL;
+
+
+/**
+ * Runs asynchronous tests on one EventLoop, each checking into its own
+ * result, and times each from its start to its return.
+ */
+class AsyncRun
+{
+public:
+  /// With watched, each test is watched by Watchdog::instance(), if it
+  /// is watching, from its start until it returns.
+  explicit AsyncRun(bool theWatched = false) : watched(theWatched && Watchdog::instance().watching()) { }
+
+  void add(AsyncTest &test, TestResult &result) { slots.push_back(Slot{ &test, &result, this }); }
+
+  void run()
+  {
+    EventLoop loop;
+    std::vector<AsyncTask> tasks;
+    tasks.reserve(slots.size());
+    outstanding = slots.size();
+    for (Slot &slot : slots)
+    {
+      slot.started = steadyNanoseconds();
+      if (watched) Watchdog::instance().enter(*slot.test);
+      tasks.push_back(slot.test->body(*slot.result));
+      AsyncTask::promise_type &promise = tasks.back().coroutine().promise();
+      promise.finished = &Slot::finish;
+      promise.context = &slot;
+      loop.schedule(tasks.back().coroutine());
+    }
+
+    bool finished = loop.run(outstanding);
+    for (std::size_t i = 0; i < slots.size(); ++i)
+    {
+      Slot &slot = slots[i];
+      if (!finished && !tasks[i].coroutine().done())
+      {
+        slot.ended = steadyNanoseconds();
+        if (watched) Watchdog::instance().leave(*slot.test);
+        slot.result->countChecks(0, 1);
+        slot.result->addFailure(Failure(slot.test->name(), slot.test->file(), slot.test->line(),
+                                        "waits for nothing that can happen"));
+        FixtureGroups::instance().ended(*slot.test);
+        continue;
+      }
+      std::exception_ptr exception = tasks[i].coroutine().promise().exception;
+      if (!exception) continue;
+      try
+      {
+        std::rethrow_exception(exception);
+      }
+      catch (const std::exception &ex)
+      {
+        MessageStream message(slot.result->messages());
+        message << "unhandled exception: " << ex.what();
+        slot.result->countChecks(0, 1);
+        slot.result->addFailure(Failure(slot.test->name(), slot.test->file(), slot.test->line(), message.finish()));
+      }
+      catch (...)
+      {
+        slot.result->countChecks(0, 1);
+        slot.result->addFailure(Failure(slot.test->name(), slot.test->file(), slot.test->line(),
+                                        "unhandled non standard exception"));
+      }
+    }
+  }
+
+  /// Seconds test i ran, from its start until it returned.
+  double seconds(std::size_t i) const { return static_cast<double>(slots[i].ended - slots[i].started) * 1.0e-9; }
+
+private:
+  struct Slot
+  {
+    AsyncTest *test;
+    TestResult *result;
+    AsyncRun *run;
+    long long started = 0;
+    long long ended = 0;
+
+    static void finish(void *context)
+    {
+      Slot &slot = *static_cast<Slot *>(context);
+      slot.ended = steadyNanoseconds();
+      --slot.run->outstanding;
+      if (slot.run->watched) Watchdog::instance().leave(*slot.test);
+      FixtureGroups::instance().ended(*slot.test);
+    }
+  };
+
+  std::deque<Slot> slots;
+  std::size_t outstanding = 0;
+  bool watched;
+};
+
+
+/**
+ * Take the asynchronous tests out of list and run them together, then
+ * report them in the order they were listed.
+ */
+void
+runAsyncTests(std::vector<Test *> &list, TestResult &result, Durations &durations)
+{
+  std::vector<AsyncTest *> tests;
+  std::vector<Test *> others;
+  for (Test *test : list)
+  {
+    AsyncTest *asynchronous = dynamic_cast<AsyncTest *>(test);
+    if (asynchronous != NULL) tests.push_back(asynchronous);
+    else others.push_back(test);
+  }
+  if (tests.empty()) return;
+  list.swap(others);
+
+  std::deque<BufferedResult> buffers(tests.size());
+  AsyncRun run(true);
+  for (std::size_t i = 0; i < tests.size(); ++i) run.add(*tests[i], buffers[i]);
+  run.run();
+
+  std::lock_guard<std::mutex> guard(reportLock);
+  for (std::size_t i = 0; i < tests.size(); ++i)
+  {
+    TestStats stats;
+    stats.wallSeconds = run.seconds(i);
+    stats.checks = buffers[i].checks();
+    stats.failures = buffers[i].failedChecks();
+    result.testStarted(*tests[i]);
+    buffers[i].replay(result);
+    result.testEnded(*tests[i], stats);
+    recordRun(durations, *tests[i], stats);
+  }
+}
+
+} // namespace
+
+
+void
+AsyncWait::await_suspend(std::coroutine_handle<> awaiting) const
+{
+  EventLoop *loop = EventLoop::current();
+  if (loop == NULL) throw std::logic_error("an AsyncWait is awaited outside an AsyncTest");
+  loop->wait(*this, awaiting);
+}
+
+
+AsyncWait
+AsyncTest::sleepFor(std::chrono::nanoseconds duration)
+{
+  AsyncWait wait;
+  wait.kind = AsyncWait::Kind::time;
+  wait.deadline = steadyNanoseconds() + duration.count();
+  return wait;
+}
+
+
+void
+AsyncTest::run(TestResult &result)
+{
+  AsyncRun run;
+  run.add(*this, result);
+  run.run();
+}
+
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+: mapped(std::exchange(other.mapped, nullptr)),
+  length(std::exchange(other.length, 0)),
+  unmap(std::exchange(other.unmap, false))
+{ }
+
+
+MappedFile &
+MappedFile::operator=(MappedFile other) noexcept
+{
+  std::swap(mapped, other.mapped);
+  std::swap(length, other.length);
+  std::swap(unmap, other.unmap);
+  return *this;
+}
+
+
+bool
+MappedFile::open(const std::string &path)
+{
+  close();
+#if defined(__unix__) || defined(__APPLE__)
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat status;
+  if (::fstat(fd, &status) != 0)
+  {
+    int error = errno;
+    ::close(fd);
+    errno = error;
+    return false;
+  }
+  if (status.st_size > 0)
+  {
+    void *address = ::mmap(NULL, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+      errno = error;
+      return false;
+    }
+    ::madvise(address, static_cast<std::size_t>(status.st_size), MADV_SEQUENTIAL);
+    mapped = static_cast<const std::byte *>(address);
+    length = static_cast<std::size_t>(status.st_size);
+    unmap = true;
+  }
+  else ::close(fd);
+#else
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+  {
+    errno = ENOENT;
+    return false;
+  }
+  std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::byte *copy = new std::byte[contents.size() + 1];
+  std::memcpy(copy, contents.data(), contents.size());
+  mapped = copy;
+  length = contents.size();
+#endif
+  return true;
+}
+
+
+void
+MappedFile::close()
+{
+  if (mapped == nullptr) return;
+#if defined(__unix__) || defined(__APPLE__)
+  if (unmap) ::munmap(const_cast<std::byte *>(mapped), length);
+  else delete[] mapped;
+#else
+  delete[] mapped;
+#endif
+  mapped = nullptr;
+  length = 0;
+  unmap = false;
+}
+
+
+void
+DataRecord::copyBytes(void *target, const std::byte *source, std::size_t length)
+{
+  std::memcpy(target, source, length);
+}
+
+
+namespace {
+
+/**
+ * Buffers what one thread of a DataTest checks, adding the index of the
+ * record being checked to each failure.
+ */
+class RecordResult : public TestResult
+{
+public:
+  void addFailure(const Failure &failure) override
+  {
+    MessageStream message(messages());
+    message << "record " << record << ": " << failure.message;
+    failures.push_back(Failure(failure.testName, failure.fileName, failure.lineNumber, message.finish()));
+  }
+
+  void testsEnded() override { }
+
+  void replay(TestResult &target)
+  {
+    target.countChecks(checks(), failedChecks());
+    target.messages().adopt(std::move(messages()));
+    for (const Failure &failure : failures) target.addFailure(failure);
+  }
+
+  std::size_t record = 0;
+
+private:
+  std::vector<Failure> failures;
+};
+
+
+/// The number of records in bytes, the last of which may lack its delimiter.
+std::size_t
+countRecords(std::span<const std::byte> bytes, const DataFormat &format)
+{
+  if (format.recordSize != 0) return bytes.size() / format.recordSize;
+  if (bytes.empty()) return 0;
+  std::size_t rows = static_cast<std::size_t>(std::count(bytes.begin(), bytes.end(), std::byte(format.delimiter)));
+  return bytes.back() == std::byte(format.delimiter) ? rows : rows + 1;
+}
+
+
+/// Where the run of records that would end at about end really ends.
+std::size_t
+recordBoundary(std::span<const std::byte> bytes, const DataFormat &format, std::size_t end)
+{
+  if (end >= bytes.size()) return bytes.size();
+  if (format.recordSize != 0) return end - end % format.recordSize;
+  const void *delimiter = std::memchr(bytes.data() + end, format.delimiter, bytes.size() - end);
+  return delimiter == NULL ? bytes.size() : static_cast<std::size_t>(static_cast<const std::byte *>(delimiter) - bytes.data()) + 1;
+}
+
+
+/// Check each record of bytes, the first of which is record number first of the file.
+void
+checkRecords(DataTest &test, std::span<const std::byte> bytes, const DataFormat &format,
+             std::size_t first, RecordResult &result)
+{
+  std::size_t offset = 0;
+  for (result.record = first; offset < bytes.size(); ++result.record)
+  {
+    std::size_t length;
+    std::size_t next;
+    if (format.recordSize != 0)
+    {
+      if (bytes.size() - offset < format.recordSize) break;
+      length = next = format.recordSize;
+    }
+    else
+    {
+      const void *delimiter = std::memchr(bytes.data() + offset, format.delimiter, bytes.size() - offset);
+      length = delimiter == NULL ? bytes.size() - offset : static_cast<std::size_t>(static_cast<const std::byte *>(delimiter) - bytes.data()) - offset;
+      next = length + 1;
+      if (format.delimiter == '\n' && length > 0 && bytes[offset + length - 1] == std::byte('\r')) --length;
+    }
+    try
+    {
+      test.checkRecord(result, DataRecord(result.record, bytes.subspan(offset, length)));
+    }
+    catch (const std::exception &ex)
+    {
+      MessageStream message(result.messages());
+      message << "unhandled exception: " << ex.what();
+      result.countChecks(0, 1);
+      result.addFailure(Failure(test.name(), test.file(), test.line(), message.finish()));
+    }
+    catch (...)
+    {
+      result.countChecks(0, 1);
+      result.addFailure(Failure(test.name(), test.file(), test.line(), "unhandled non standard exception"));
+    }
+    offset += next;
+  }
+}
+
+} // namespace
+
+
+std::string
+DataTest::dataFile() const
+{
+  // Look next to the source file for a relative path not found from here.
+  std::string where(dataPath);
+  std::string_view source = file();
+  std::size_t slash = source.find_last_of("/\\");
+  if (where.empty() || where[0] == '/' || slash == std::string_view::npos) return where;
+  std::error_code error;
+  if (std::filesystem::exists(where, error)) return where;
+  std::string beside = std::string(source.substr(0, slash + 1)) + where;
+  return std::filesystem::exists(beside, error) ? beside : where;
+}
+
+
+void
+DataTest::run(TestResult &result)
+{
+  MappedFile mapped;
+  std::string where = dataFile();
+  if (!mapped.open(where))
+  {
+    MessageStream message(result.messages());
+    message << "cannot map " << where << ": " << std::strerror(errno);
+    result.countChecks(0, 1);
+    result.addFailure(Failure(name(), file(), line(), message.finish()));
+    return;
+  }
+
+  // At least a megabyte to each thread, so the threads earn their start.
+  std::span<const std::byte> bytes = mapped.bytes();
+  std::size_t runs = std::clamp<std::size_t>(bytes.size() >> 20, 1, workers);
+  std::vector<std::size_t> starts(runs + 1, bytes.size());
+  starts[0] = 0;
+  for (std::size_t i = 1; i < runs; ++i) starts[i] = recordBoundary(bytes, format, std::max(starts[i - 1], bytes.size() / runs * i));
+
+  std::vector<RecordResult> buffers(runs);
+  if (runs == 1) checkRecords(*this, bytes, format, 0, buffers[0]);
+  else
+  {
+    // Each thread counts the records of its run, so all know where theirs start.
+    std::vector<std::size_t> counts(runs);
+    std::latch counted(static_cast<std::ptrdiff_t>(runs));
+    std::vector<std::thread> threads;
+    threads.reserve(runs);
+    for (std::size_t index = 0; index < runs; ++index)
+    {
+      threads.emplace_back([&, index]() {
+        std::span<const std::byte> run = bytes.subspan(starts[index], starts[index + 1] - starts[index]);
+        counts[index] = countRecords(run, format);
+        counted.arrive_and_wait();
+        std::size_t first = std::accumulate(counts.begin(), counts.begin() + static_cast<std::ptrdiff_t>(index), std::size_t(0));
+        checkRecords(*this, run, format, first, buffers[index]);
+      });
+    }
+    for (std::thread &thread : threads) thread.join();
+  }
+  for (RecordResult &buffer : buffers) buffer.replay(result);
+
+  if (format.recordSize != 0 && bytes.size() % format.recordSize != 0)
+  {
+    MessageStream message(result.messages());
+    message << where << " ends with " << bytes.size() % format.recordSize << " bytes of a record of "
+            << format.recordSize;
+    result.countChecks(0, 1);
+    result.addFailure(Failure(name(), file(), line(), message.finish()));
+  }
+}
+
+
+// The linker defines these around the section cppunitxlite, where TEST and
+// BENCHMARK put pointers to their entries.  Weak, for a program without
+// any: then they are null.
+#if defined(__APPLE__)
+extern const TestEntry *const testEntriesBegin[] __asm("section$start$__DATA$cppunitxlite");
+extern const TestEntry *const testEntriesEnd[] __asm("section$end$__DATA$cppunitxlite");
+#elif defined(__ELF__)
+extern "C" [[gnu::weak]] const TestEntry *const __start_cppunitxlite[];
+extern "C" [[gnu::weak]] const TestEntry *const __stop_cppunitxlite[];
+#endif
+
+
+TestRegistry::TestRegistry()
+{
+#if defined(__APPLE__)
+  const TestEntry *const *begin = testEntriesBegin, *const *end = testEntriesEnd;
+#elif defined(__ELF__)
+  const TestEntry *const *begin = __start_cppunitxlite, *const *end = __stop_cppunitxlite;
+#else
+  const TestEntry *const *begin = nullptr, *const *end = nullptr;
+#endif
+  if (begin == nullptr) return;
+  table.reserve(static_cast<std::size_t>(end - begin));
+  for (const TestEntry *const *entry = begin; entry != end; ++entry)
+  {
+    // Sanitizers may pad the section between the pointers.
+    if (*entry != nullptr) add(**entry);
+  }
+
+  // Each object file contributes its entries together, though the compiler
+  // need not emit them in the order they are declared.
+  for (auto first = table.begin(); first != table.end();)
+  {
+    auto last = std::find_if(first, table.end(), [first](const TestInfo &info) { return info.file != first->file; });
+    std::sort(first, last, [](const TestInfo &a, const TestInfo &b) { return a.line < b.line; });
+    first = last;
+  }
+}
+
+
+void TestRegistry::add(Test *test)
+{
+  table.push_back(TestInfo{test, nullptr, test->group(), test->name(), test->file(), test->line()});
+}
+
+
+void TestRegistry::add(const TestEntry &entry)
+{
+  table.push_back(TestInfo{nullptr, &entry, entry.group, entry.name, entry.file, entry.line});
+}
+
+
+std::vector<TestInfo *>
+TestRegistry::select(const RunOptions &options)
+{
+  NamePatterns filters(options.filters);
+  NamePatterns excludes(options.excludes);
+
+  std::vector<TestInfo *> list;
+  std::size_t position = 0;
+  std::string scratch;
+  for (TestInfo &info : table)
+  {
+    bool benchmark = info.entry != nullptr ? info.entry->benchmark : info.test->isBenchmark();
+    if (benchmark != options.benchmarks) continue;
+    if (!filters.empty() && !filters.matches(info, scratch)) continue;
+    if (!excludes.empty() && excludes.matches(info, scratch)) continue;
+    if (position++ % options.shardCount == options.shardIndex) list.push_back(&info);
+  }
+  return list;
+}
+
+
+void TestRegistry::run(TestResult &result, const RunOptions &options)
+{
+  std::vector<TestInfo *> selected = select(options);
+  if (options.list)
+  {
+    std::string listing;
+    for (const TestInfo *info : selected)
+    {
+      if (!info->group.empty()) listing.append(info->group).append(1, '.');
+      listing.append(info->name).append("  ").append(info->file);
+      listing.append(1, ':').append(std::to_string(info->line)).append(1, '\n');
+    }
+    std::cout << listing << std::flush;
+    return;
+  }
+
+  // Only now construct the tests TEST and BENCHMARK declared, and only those selected.
+  std::vector<Test *> list;
+  list.reserve(selected.size());
+  for (TestInfo *info : selected)
+  {
+    if (info->test == nullptr) info->test = &info->entry->instance();
+    list.push_back(info->test);
+  }
+
+  // Leave out the tests that passed before, or with rerunFailed those that did not fail.
+  ResultCache &cache = ResultCache::instance();
+  cache.load(options);
+  if (cache.enabled() && !options.benchmarks)
+  {
+    std::vector<Test *> uncached;
+    for (Test *test : list)
+    {
+      if (options.rerunFailed)
+      {
+        if (cache.failedBefore(*test)) uncached.push_back(test);
+      }
+      else if (cache.passedBefore(*test)) result.testCached(*test);
+      else uncached.push_back(test);
+    }
+    list.swap(uncached);
+  }
+
+  // Benchmarks run one at a time, so they do not compete for the machine.
+  unsigned int jobs = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+  jobs = options.benchmarks ? 1 : static_cast<unsigned int>(std::min<std::size_t>(jobs, list.size()));
+  Durations durations = readDurations(options.durationsFile);
+  Baselines::instance().load(options.baselinesFile, options.updateBaselines);
+  if (options.slowest > 0) result.reportSlowest(options.slowest);
+  if (options.allocations) result.reportAllocations(true);
+  if (options.counters) result.reportCounters(true);
+  FixtureGroups::instance().expect(list);
+  ConcurrentTest::configure(options.pinThreads, options.yieldOneIn);
+  DataTest::configure(options.jobs != 0 ? options.jobs : std::thread::hardware_concurrency());
+  updatingSnapshots = options.updateSnapshots;
+  Profiler::instance().start(options.benchmarks ? std::string() : options.profileFile, durations);
+  auto save = [&options, &durations, &cache]() {
+    writeDurations(options.durationsFile, durations);
+    Baselines::instance().save();
+    cache.save();
+    Profiler::instance().finish();
+  };
+  Watchdog &watchdog = Watchdog::instance();
+  watchdog.configure(list, options.benchmarks ? 0.0 : options.timeoutSeconds, options.benchmarks ? 0.0 : options.runTimeoutSeconds);
+  if (!options.isolate)
+  {
+    watchdog.start(&result, [&durations](const Test &test, const TestStats &stats) { recordRun(durations, test, stats); }, save);
+  }
+  if (!options.isolate && !options.benchmarks) runAsyncTests(list, result, durations);
+
+  if (options.isolate && !options.benchmarks && !list.empty())
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    IsolatedRun(list, result, durations, options.counters).run(jobs);
+#else
+    throw std::runtime_error("--isolate needs fork(), which this platform lacks");
+#endif
+  }
+  else if (jobs > 1 || (jobs == 1 && watchdog.watching()))
+  {
+    // A watched run reports from another thread, which the watchdog can interrupt.
+    ParallelRun(list, result, durations, options.counters).run(jobs);
+  }
+  else
+  {
+    for (Test *test : list)
+    {
+      result.testStarted(*test);
+      TestStats stats = guardedRun(*test, result, options.counters);
+      result.testEnded(*test, stats);
+      recordRun(durations, *test, stats);
+    }
+  }
+
+  watchdog.stop();
+  save();
+  result.testsEnded();
+}
+
+
+int
+TestRegistry::main(int argc, char **argv)
+{
+  try
+  {
+    RunOptions options = RunOptions::fromCommandLine(argc, argv);
+    std::unique_ptr<TestResult> result;
+    std::string reportFile = options.reporter.empty() ? std::string() : options.reporter.substr(6);
+    if (options.reporter.rfind("junit:", 0) == 0) result.reset(new JUnitXmlResult(reportFile));
+    else if (options.reporter.rfind("jsonl:", 0) == 0) result.reset(new JsonLinesResult(reportFile));
+    else result.reset(new TestResult);
+    runAll(*result, options);
+  }
+  catch (const std::exception &error)
+  {
+    std::cerr << (argc > 0 ? argv[0] : "tests") << ": " << error.what() << std::endl;
+    return 2;
+  }
+  return 0;
 }
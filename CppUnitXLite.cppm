@@ -0,0 +1,67 @@
+// -*- mode:C++; c-basic-offset:2; indent-tabs-mode:nil -*-
+/*
+Copyright © 2015 Glen S. Dayton
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/**
+ *  Module interface of CppUnitXLite.
+ *
+ *  import CppUnitXLite;
+ *  #include <CppUnitXLite/CppUnitXLiteMacros.hpp>
+ *
+ *  TEST(test_classname, test_name)
+ *  {
+ *     CHECK_EQUAL(expected, actual);
+ *  }
+ *
+ *  TESTMAIN
+ *
+ *  The declarations stay in CppUnitXLite.hpp and CppUnitXLiteAsync.hpp,
+ *  parsed once when the module is built; a test that imports the module
+ *  reads the built interface instead.  The definitions remain in
+ *  CppUnitXLite.cpp, compiled into the library as before.
+ */
+
+module;
+
+// the standard headers CppUnitXLite.hpp and CppUnitXLiteAsync.hpp include,
+// so that including them below declares nothing else in the module
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iosfwd>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+export module CppUnitXLite;
+
+// extern "C++" keeps the declarations attached to the global module, where
+// CppUnitXLite.cpp defines them.
+export extern "C++" {
+#include "CppUnitXLite.hpp"
+#include "CppUnitXLiteAsync.hpp"
+}
@@ -52,52 +52,237 @@ THE SOFTWARE.
 #ifndef CPP_UNIT_X_LITE_H_
 #define CPP_UNIT_X_LITE_H_
 
-#include <iostream>
-#include <sstream>
+#include <cstddef>
+#include <iosfwd>
+#include <new>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 struct Failure;
 
 class Test;
 
+struct TestEntry;
+
 class TestRegistry;
 
 class TestResult;
 
 
-#define TEST(testGroup, testName)\
-class testGroup##testName##Test : public Test \
-{ public: testGroup##testName##Test () : Test (#testName "Test") {} \
-  void run (TestResult& theResult); } \
-testGroup##testName##Instance; \
-void testGroup##testName##Test::run (TestResult& theResult)
+#include "CppUnitXLiteMacros.hpp"
+
+
+/**
+ * Options controlling how TestRegistry::runAll() executes the tests.
+ *
+ * RunOptions is an aggregate, so a custom main() may write
+ * TestRegistry::runAll(result, RunOptions{.jobs = 8}).  TESTMAIN builds
+ * one from the command line with fromCommandLine(), which understands
+ *
+ *   --jobs=N, -jN       run the tests on N worker threads (0 = one per core)
+ *   --durations=PATH    read and update the test durations kept in PATH
+ *   --shard=i/N         run only every N-th test, starting with the i-th
+ *   --isolate           run the tests in forked worker processes
+ *   --bench             run the benchmarks instead of the tests
+ *   --slowest=N         finish with the N slowest tests and the time per group
+ *   --reporter=junit:PATH  also write the results to PATH as JUnit XML
+ *   --reporter=jsonl:PATH  also write the results to PATH as JSON lines
+ *   --filter=PATTERNS   run only the tests whose group.name matches a pattern
+ *   --exclude=PATTERNS  skip the tests whose group.name matches a pattern
+ *   --list              print the tests that would run, and run none
+ *   --allocations       finish with the heap allocations of each test
+ *   --counters          count CPU events per test and finish with them by group
+ *   --baselines=PATH    compare CHECK_NOT_SLOWER timings with those kept in PATH
+ *   --update-baselines  rewrite PATH with the timings of this run instead
+ *   --pin-threads       pin the threads of each CONCURRENT_TEST to CPUs in turn
+ *   --yield=N           have CONCURRENT_TEST threads yield about once in N runs
+ *   --update-snapshots  rewrite the golden files of CHECK_SNAPSHOT that differ
+ *   --cache=PATH        skip the tests that passed before in this build, as kept in PATH
+ *   --cache-inputs=PATHS  also key the cache on the contents of these files
+ *   --rerun-failed      run only the tests PATH says failed the last time they ran
+ *   --profile=PATH      sample the stack of each test and write folded stacks to PATH
+ *   --timeout=SECONDS   fail a test still running after SECONDS, unless it sets its own
+ *   --run-timeout=SECONDS  end the run, failing the tests still running, after SECONDS
+ *
+ * PATTERNS is a comma separated list of globs, in which * matches any
+ * text and ? any one character, or a single ECMAScript regular
+ * expression between slashes: --filter=/^Parser\.(Parse|Scan)/.
+ */
+struct RunOptions {
+    /// Number of worker threads; 1 runs every test on the calling thread.
+    /// Also the most threads that share the records of one TEST_DATA file.
+    unsigned int jobs = 1;
+
+    /// File of past test durations used to balance the workers.  Empty
+    /// means the durations are neither read nor written.
+    std::string durationsFile;
+
+    /// Run only the tests whose position modulo shardCount is shardIndex.
+    unsigned int shardIndex = 0;
+    unsigned int shardCount = 1;
+
+    /// Run the tests in jobs forked processes, so a test that crashes or
+    /// changes global state cannot take the rest of the run with it.
+    bool isolate = false;
+
+    /// Run the registered benchmarks, one at a time, instead of the tests.
+    bool benchmarks = false;
+
+    /// Length of the slowest tests list printed by TestResult::testsEnded();
+    /// zero prints no timing summary.
+    unsigned int slowest = 0;
+
+    /// Where TestRegistry::main() writes a machine readable copy of the
+    /// results: "junit:PATH", "jsonl:PATH", or empty for none.
+    std::string reporter;
+
+    /// Run only the tests matching one of filters, if there are any, and
+    /// none of excludes.  Each entry holds PATTERNS as described above.
+    std::vector<std::string> filters;
+    std::vector<std::string> excludes;
+
+    /// Print the selected tests with their file and line instead of
+    /// running them.
+    bool list = false;
+
+    /// Have TestResult::testsEnded() list the allocations of each test.
+    bool allocations = false;
+
+    /// Read performance counters around each test (Linux only) and have
+    /// TestResult::testsEnded() summarize them per test group.
+    bool counters = false;
+
+    /// File of the timings CHECK_NOT_SLOWER compares with, and whether
+    /// this run replaces them instead.  Updating needs the timings in this
+    /// process, so it cannot be combined with isolate.
+    std::string baselinesFile;
+    bool updateBaselines = false;
 
-#define CHECK(condition) check(theResult, (condition), #condition, __FILE__, __LINE__)
+    /// Pin the threads of a ConcurrentTest to the allowed CPUs in turn
+    /// (Linux only), and have them yield at random, about once in
+    /// yieldOneIn runs of the body; zero never yields.
+    bool pinThreads = false;
+    unsigned int yieldOneIn = 0;
 
-#define CHECK_EQUAL(expected, actual) checkEqual((expected), (actual), theResult, __FILE__, __LINE__)
-#define CHECK_LE(expected, actual) checkLE((expected), (actual), theResult, __FILE__, __LINE__)
-#define CHECK_LT(expected, actual) checkLT((expected), (actual), theResult, __FILE__, __LINE__)
-#define CHECK_GT(expected, actual) checkGT((expected), (actual), theResult, __FILE__, __LINE__)
-#define CHECK_GE(expected, actual) checkGE((expected), (actual), theResult, __FILE__, __LINE__)
+    /// Have CHECK_SNAPSHOT replace golden files that differ, or are
+    /// missing, with what the tests produced, instead of failing.
+    bool updateSnapshots = false;
 
-#define CHECK_APPROX_EQUAL(expected, actual, threshold) checkApproxEqual((expected), (actual), (threshold), theResult, __FILE__, __LINE__)
+    /// File of the outcome of each test, keyed by the build ID of the test
+    /// program, the test's name and the contents of its inputs() and of
+    /// cacheInputs.  A test that passed under the same key is skipped and
+    /// reported as cached; with rerunFailed, only the tests that failed
+    /// the last time they ran are run.  Concurrent shards may share it.
+    std::string cacheFile;
+    std::vector<std::string> cacheInputs;
+    bool rerunFailed = false;
 
-#define FAIL(text) fail(theResult, (text), __FILE__, __LINE__)
+    /// Sample the stack of the thread running each test about once per
+    /// millisecond of its CPU time (Linux only), and when the run ends
+    /// write the samples to this file as folded stacks rooted at the
+    /// test's group.name, for flame graph tools.  The tests are sampled
+    /// in this process, so it cannot be combined with isolate;
+    /// asynchronous tests and threads the tests start are not sampled.
+    /// Stacks are found by their frame pointers, so tests built with
+    /// -fno-omit-frame-pointer give whole stacks.  The room for a test's
+    /// samples follows its duration in durationsFile.
+    std::string profileFile;
 
-#define TESTMAIN int main(int, char **) { TestResult tr; TestRegistry::runAll(tr); return 0; }
+    /// Most seconds a test may run, unless it declares its own timeout,
+    /// and most seconds the whole run may take; zero is no limit.  A
+    /// watchdog thread fails a test that overruns and writes the stacks
+    /// of all threads to standard error.  The tests cannot be stopped, so
+    /// the run then ends, reporting what finished, except under isolate,
+    /// where only the worker process running the test is ended and the
+    /// run goes on.  Asynchronous tests are watched the same way while
+    /// they wait on the event loop.
+    double timeoutSeconds = 0.0;
+    double runTimeoutSeconds = 0.0;
+
+    static auto fromCommandLine(int argc, char **argv) -> RunOptions;
+};
+
+
+/**
+ * Where a registered test is declared.  TestRegistry keeps these in one
+ * table, in registration order, so selecting tests does not touch the
+ * tests themselves.
+ */
+struct TestInfo {
+    Test *test;               ///< null until the test is first selected, if entry is not
+    const TestEntry *entry;   ///< null for a test constructed by hand
+    std::string_view group;
+    std::string_view name;
+    std::string_view file;
+    unsigned int line;
+};
+
+
+/**
+ * What TEST and BENCHMARK declare about a test instead of constructing it.
+ * An entry is constant initialized, so a program with many tests runs no
+ * code at startup to register them; instance() constructs the test, once,
+ * when a run first selects it.
+ */
+struct TestEntry {
+    const char *group;
+    const char *name;
+    const char *file;
+    unsigned int line;
+    bool benchmark;
+    Test &(*instance)();
+    double timeoutSeconds = 0.0;   ///< as given to TEST; zero uses RunOptions::timeoutSeconds
+};
 
 
 /**
- * Constructor of Test registers the test instance with the
- * TestRegistry during the static initialization phase.
+ * The registry of tests.  TEST and BENCHMARK place a pointer to their
+ * TestEntry in the linker section cppunitxlite, which the registry reads
+ * when first used; where there is no such section they call addEntry()
+ * during static initialization instead.  A Test constructed by hand
+ * registers itself with addTest() from its constructor.  The declared
+ * tests come first, in link order, then those constructed by hand; within
+ * a file each kind keeps the order it is declared in.
  */
 class TestRegistry {
 public:
-    TestRegistry() : tests(nullptr) {}
+    TestRegistry();
+
     static void addTest(Test *test) { instance().add(test); }
 
-    static void runAll(TestResult &result) { instance().run(result); }
+    static auto addEntry(const TestEntry &entry) -> bool {
+        instance().add(entry);
+        return true;
+    }
+
+    /// Every registered test, in registration order.
+    static auto tests() -> const std::vector<TestInfo> & { return instance().table; }
+
+    static void runAll(TestResult &result) { instance().run(result, RunOptions()); }
+
+    /**
+     * Run every registered test.  With options.jobs > 1 the tests spread
+     * over a work-stealing pool of threads.  Each test records into its own
+     * buffer, and the buffers replay into result one test at a time in the
+     * same order a serial run reports them, so output does not interleave
+     * and result never sees two calls at once.  With options.isolate the
+     * workers are processes instead of threads, and a test that kills its
+     * process is reported as a failure.  However the tests run, an
+     * exception a test lets escape fails that test and the run goes on.
+     */
+    static void runAll(TestResult &result, const RunOptions &options) { instance().run(result, options); }
+
+    /**
+     * What TESTMAIN does: run the tests as the command line says, with the
+     * reporter it names, and return the exit status of the program.  A bad
+     * command line is reported on std::cerr and returns 2.
+     */
+    static auto main(int argc, char **argv) -> int;
 
 private:
     static TestRegistry &instance() {
@@ -107,19 +292,284 @@ private:
 
     void add(Test *test);
 
-    void run(TestResult &result);
+    void add(const TestEntry &entry);
+
+    void run(TestResult &result, const RunOptions &options);
+
+    auto select(const RunOptions &options) -> std::vector<TestInfo *>;
+
+    std::vector<TestInfo> table;
+};
+
+
+/**
+ *  CHECK_EQUAL compares arguments that are ranges, such as containers and
+ *  arrays, element by element.  Anything convertible to std::string_view,
+ *  including character arrays, is compared as a string instead.
+ */
+template<typename RangeType>
+concept CheckableRange = !std::is_convertible_v<const RangeType &, std::string_view> &&
+                         requires(const RangeType &range) {
+                             std::begin(range);
+                             std::end(range);
+                             std::size(range);
+                         };
+
+template<typename ValueType>
+concept Streamable = requires(std::ostream &out, const ValueType &value) { out << value; };
+
+
+/**
+ *  How far apart CHECK_ALL_APPROX_EQUAL lets two elements be.  An element
+ *  is within tolerance when any one of the limits holds: the absolute
+ *  difference is at most absolute, the difference is at most relative
+ *  times the larger magnitude, or the values are at most ulps
+ *  representable values apart.  NaN is never within tolerance.
+ */
+struct ApproxTolerance {
+    double absolute = 0.0;
+    double relative = 0.0;
+    unsigned long long ulps = 0;
+};
+
+
+/**
+ *  Storage for failure messages.  Messages are packed into large blocks,
+ *  so recording a failure seldom allocates, and a message never moves once
+ *  written: Failure keeps a std::string_view of it for as long as the arena
+ *  lives.  adopt() takes over the blocks of another arena, leaving every
+ *  view into them valid, and clear() drops every message at once.
+ */
+class MessageArena {
+public:
+    MessageArena() = default;
+
+    MessageArena(const MessageArena &) = delete;
+
+    auto operator=(const MessageArena &) -> MessageArena & = delete;
+
+    /// Copy text into the arena.
+    auto store(std::string_view text) -> std::string_view;
+
+    /// Extend the message being built; finish() closes it.
+    void append(const char *text, std::size_t length);
+
+    auto finish() -> std::string_view;
+
+    /// Drop a message left open, such as when formatting threw.
+    void discard();
+
+    void adopt(MessageArena &&other);
 
-    Test *tests;
+    /// Drop every message, none of which may be referred to any more,
+    /// keeping the newest block for the messages to come.
+    void clear();
+
+    /// Bytes of the blocks held.
+    [[nodiscard]] auto capacity() const -> std::size_t;
+
+private:
+    void grow(std::size_t length);
+
+    std::vector<std::vector<char>> blocks;  ///< a block's bytes stay put as blocks grows
+    char *open = nullptr;
+    char *cursor = nullptr;
+    char *limit = nullptr;
+};
+
+
+/// Formats one message straight into a MessageArena; CppUnitXLite.cpp.
+class MessageStream;
+
+
+/**
+ *  A value to show in a failure message.  Numbers, characters, strings and
+ *  pointers are copied in; anything else is kept by address, with a
+ *  function that streams it, and must outlive the FormattedValue.  All
+ *  formatting happens in CppUnitXLite.cpp, so a check instantiates only the
+ *  comparison and, for types of its own, one operator<< call.
+ */
+class FormattedValue {
+public:
+    FormattedValue() : kind(Kind::unprintable) {}
+
+    template<typename ValueType>
+    FormattedValue(const ValueType &value) {  // NOLINT(google-explicit-constructor)
+        if constexpr (std::is_same_v<ValueType, bool>) {
+            kind = Kind::boolean;
+            natural = value;
+        } else if constexpr (std::is_integral_v<ValueType> && sizeof(ValueType) == 1) {
+            kind = Kind::character;
+            character = static_cast<char>(value);
+        } else if constexpr (std::is_integral_v<ValueType> && std::is_signed_v<ValueType>) {
+            kind = Kind::integer;
+            integer = value;
+        } else if constexpr (std::is_integral_v<ValueType>) {
+            kind = Kind::natural;
+            natural = value;
+        } else if constexpr (std::is_floating_point_v<ValueType>) {
+            kind = Kind::real;
+            real = value;
+        } else if constexpr (std::is_convertible_v<const ValueType &, std::string_view>) {
+            if constexpr (std::is_pointer_v<ValueType>) {
+                if (value == nullptr) {
+                    kind = Kind::text;
+                    text = std::string_view("<null>");
+                    return;
+                }
+            }
+            kind = Kind::text;
+            text = std::string_view(value);
+        } else if constexpr (std::is_null_pointer_v<ValueType>) {
+            kind = Kind::text;
+            text = std::string_view("nullptr");
+        } else if constexpr (std::is_pointer_v<ValueType> && std::is_object_v<std::remove_pointer_t<ValueType>>) {
+            kind = Kind::pointer;
+            pointer = static_cast<const volatile void *>(value);
+        } else if constexpr (Streamable<ValueType>) {
+            kind = Kind::streamed;
+            object = &value;
+            stream = &streamValue<ValueType>;
+        } else if constexpr (std::is_enum_v<ValueType>) {
+            kind = Kind::integer;
+            integer = static_cast<long long>(value);
+        } else {
+            kind = Kind::unprintable;
+        }
+    }
+
+    /// Append the value to out; '?' if it has no operator<<.
+    void print(MessageStream &out) const;
+
+private:
+    enum class Kind { unprintable, boolean, character, integer, natural, real, text, pointer, streamed };
+
+    template<typename ValueType>
+    static void streamValue(std::ostream &out, const void *value) { out << *static_cast<const ValueType *>(value); }
+
+    Kind kind;
+    union {
+        char character;
+        long long integer;
+        unsigned long long natural;
+        long double real;
+        const volatile void *pointer;
+        const void *object;
+    };
+    std::string_view text;
+    void (*stream)(std::ostream &, const void *) = nullptr;
+};
+
+
+/**
+ *  A range as the failure message of CHECK_EQUAL sees it: its size and a
+ *  function printing the element at an index.
+ */
+struct RangeView {
+    const void *range;
+    std::size_t size;
+    void (*printElement)(MessageStream &out, const void *range, std::size_t index);
+};
+
+
+/**
+ *  Heap allocations made by one thread.  The global operator new and
+ *  delete count them only when CppUnitXLite.cpp is compiled with
+ *  CPP_UNIT_X_LITE_TRACK_ALLOCATIONS; without it nothing is replaced and
+ *  every count stays zero.
+ */
+struct AllocationCounts {
+    unsigned long long allocations = 0;
+    unsigned long long deallocations = 0;
+    unsigned long long bytes = 0;
+};
+
+
+/**
+ *  The allocations of the calling thread since the scope began, and the
+ *  most CHECK_MAX_ALLOCATIONS allows.
+ */
+class AllocationScope {
+public:
+    AllocationScope(unsigned long long theMaxAllocations, unsigned long long theMaxBytes)
+            : maxAllocations(theMaxAllocations), maxBytes(theMaxBytes), start(counts()), pending(true) {}
+
+    /// True once, so a for statement runs the checked block once.
+    auto running() -> bool { return std::exchange(pending, false); }
+
+    [[nodiscard]] auto used() const -> AllocationCounts {
+        AllocationCounts now = counts();
+        now.allocations -= start.allocations;
+        now.deallocations -= start.deallocations;
+        now.bytes -= start.bytes;
+        return now;
+    }
+
+    /// The counts of the calling thread so far.
+    static auto counts() -> AllocationCounts;
+
+    /// Whether operator new is counting at all.
+    static auto tracking() -> bool;
+
+    const unsigned long long maxAllocations;
+    const unsigned long long maxBytes;
+
+private:
+    AllocationCounts start;
+    bool pending;
+};
+
+
+/**
+ *  The timings of one CHECK_NOT_SLOWER block.  running() lets the block
+ *  run in batches, grown until a batch lasts about a millisecond, then
+ *  keeps the time per run of each of samples() batches.
+ */
+class PerformanceSample {
+public:
+    PerformanceSample(const char *theKey, double theTolerance) : key(theKey), tolerance(theTolerance) {}
+
+    inline auto running() -> bool {
+        if (remaining == 0) return nextBatch();
+        --remaining;
+        return true;
+    }
+
+    /// Nanoseconds per run of the block, one entry per batch.
+    [[nodiscard]] auto samples() const -> const std::vector<double> & { return times; }
+
+    const char *const key;
+    const double tolerance;
+
+private:
+    auto nextBatch() -> bool;
+
+    unsigned long long batch = 1;
+    unsigned long long remaining = 0;
+    long long started = 0;
+    bool calibrated = false;
+    std::vector<double> times;
 };
 
 
 /**
  *  Inherit from Test to define your own unit test.
+ *
+ *  The group, test and file names passed to the constructor are kept by
+ *  pointer, so they must outlive the test; string literals do.
  */
 class Test {
 public:
     explicit Test(const char *theTestName);
 
+    Test(const char *theGroupName, const char *theTestName);
+
+    /// Also records where the test is declared.
+    Test(const char *theGroupName, const char *theTestName, const char *theFileName, unsigned int theLineNumber);
+
+    /// What TEST uses: takes the names from entry, which is already registered.
+    explicit Test(const TestEntry &entry);
+
     virtual ~Test() = default;
 
     /**
@@ -130,9 +580,25 @@ public:
      */
     virtual void run(TestResult &result) = 0;
 
-    inline void next(Test *test) { nextTest = test; }
+    [[nodiscard]] inline auto name() const -> std::string_view { return testName; }
+
+    [[nodiscard]] inline auto group() const -> std::string_view { return groupName; }
+
+    /// Where the test is declared; "<unknown>" and 0 unless given.
+    [[nodiscard]] inline auto file() const -> std::string_view { return fileName; }
+
+    [[nodiscard]] inline auto line() const -> unsigned int { return lineNumber; }
 
-    [[nodiscard]] inline Test *next() const { return nextTest; }
+    /// Benchmarks register like tests but only run with RunOptions::benchmarks.
+    [[nodiscard]] virtual auto isBenchmark() const -> bool { return false; }
+
+    /// Files the outcome of the test depends on, whose contents are part
+    /// of its key in the result cache (see RunOptions::cacheFile).
+    [[nodiscard]] virtual auto inputs() const -> std::vector<std::string> { return {}; }
+
+    /// Most seconds a run of the test may take before the watchdog fails
+    /// it; zero leaves it to RunOptions::timeoutSeconds.
+    [[nodiscard]] virtual auto timeout() const -> double { return timeoutSeconds; }
 
 protected:
     auto check(TestResult &result,
@@ -140,6 +606,7 @@ protected:
                const char *conditionString,
                const char *fileName = __FILE__,
                unsigned int lineNumber = __LINE__) -> bool {
+        countCheck(result);
         if (!condition) { fail(result, conditionString, fileName, lineNumber); }
         return condition;
     }
@@ -150,32 +617,56 @@ protected:
               const char *fileName = __FILE__,
               unsigned int lineNumber = __LINE__) -> bool;
 
-    template<typename SubjectType>
+    template<typename SubjectType> requires (!CheckableRange<SubjectType>)
     auto checkEqual(SubjectType expected,
                     SubjectType actual,
                     TestResult &result,
                     const char *fileName = __FILE__,
                     unsigned int lineNumber = __LINE__) -> bool {
+        countCheck(result);
         bool successful = expected == actual;
         if (!successful) {
-            std::ostringstream message;
-            message << "expected: " << expected << " but received: " << actual;
-            fail(result, message.str().c_str(), fileName, lineNumber);
+            recordComparison(result, "expected: ", expected, " but received: ", actual, fileName, lineNumber);
         }
         return successful;
     }
 
+    /**
+     * Compare two ranges, such as containers or arrays, element by element
+     * without copying them.  Contiguous ranges of the same element type
+     * whose equality is bitwise equality compare with memcmp().  A failure
+     * names the sizes, the index of the first difference and a few elements
+     * on either side of it rather than the whole ranges.
+     */
+    template<CheckableRange ExpectedRange, CheckableRange ActualRange>
+    auto checkEqual(const ExpectedRange &expected,
+                    const ActualRange &actual,
+                    TestResult &result,
+                    const char *fileName = __FILE__,
+                    unsigned int lineNumber = __LINE__) -> bool {
+        return checkRangeEqual(expected, actual, result, fileName, lineNumber);
+    }
+
+    /// Arrays of one type and size compare as ranges instead of decaying to pointers.
+    template<typename ElementType, std::size_t size> requires CheckableRange<ElementType[size]>
+    auto checkEqual(const ElementType (&expected)[size],
+                    const ElementType (&actual)[size],
+                    TestResult &result,
+                    const char *fileName = __FILE__,
+                    unsigned int lineNumber = __LINE__) -> bool {
+        return checkRangeEqual(expected, actual, result, fileName, lineNumber);
+    }
+
     template<typename SubjectType>
     auto checkLE(SubjectType expected,
                  SubjectType actual,
                  TestResult &result,
                  const char *fileName = __FILE__,
                  unsigned int lineNumber = __LINE__) -> bool {
+        countCheck(result);
         bool successful = expected <= actual;
         if (!successful) {
-            std::ostringstream message;
-            message << "expected " << expected << " not <= actual " << actual;
-            fail(result, message.str().c_str(), fileName, lineNumber);
+            recordComparison(result, "expected ", expected, " not <= actual ", actual, fileName, lineNumber);
         }
         return successful;
     }
@@ -186,11 +677,10 @@ protected:
                  TestResult &result,
                  const char *fileName = __FILE__,
                  unsigned int lineNumber = __LINE__) -> bool {
+        countCheck(result);
         bool successful = expected < actual;
         if (!successful) {
-            std::ostringstream message;
-            message << "expected " << expected << " not < actual " << actual;
-            fail(result, message.str().c_str(), fileName, lineNumber);
+            recordComparison(result, "expected ", expected, " not < actual ", actual, fileName, lineNumber);
         }
         return successful;
     }
@@ -201,11 +691,10 @@ protected:
                  TestResult &result,
                  const char *fileName = __FILE__,
                  unsigned int lineNumber = __LINE__) -> bool {
+        countCheck(result);
         bool successful = expected > actual;
         if (!successful) {
-            std::ostringstream message;
-            message << "expected " << expected << " not > actual " << actual;
-            fail(result, message.str().c_str(), fileName, lineNumber);
+            recordComparison(result, "expected ", expected, " not > actual ", actual, fileName, lineNumber);
         }
         return successful;
     }
@@ -216,11 +705,10 @@ protected:
                  TestResult &result,
                  const char *fileName = __FILE__,
                  unsigned int lineNumber = __LINE__) -> bool {
+        countCheck(result);
         bool successful = expected >= actual;
         if (!successful) {
-            std::ostringstream message;
-            message << "expected " << expected << " not >= actual " << actual;
-            fail(result, message.str().c_str(), fileName, lineNumber);
+            recordComparison(result, "expected ", expected, " not >= actual ", actual, fileName, lineNumber);
         }
         return successful;
     }
@@ -233,77 +721,1112 @@ protected:
                           const char *fileName = __FILE__,
                           unsigned int lineNumber = __LINE__) -> bool;
 
+    auto checkAllocations(TestResult &result,
+                          const AllocationScope &scope,
+                          const char *fileName = __FILE__,
+                          unsigned int lineNumber = __LINE__) -> bool;
+
+    /// Compare the median of sample with its baseline, or record it.
+    auto checkNotSlower(TestResult &result,
+                        const PerformanceSample &sample,
+                        const char *fileName = __FILE__,
+                        unsigned int lineNumber = __LINE__) -> bool;
+
+    /**
+     * Compare actual, without copying, with the golden file snapshotName
+     * in the directory snapshots next to fileName, mapped into memory.  A
+     * failure shows a few lines, or rows of hex bytes, around the first
+     * difference.  With RunOptions::updateSnapshots, replace the golden
+     * file instead, atomically, if it differs.
+     */
+    auto checkSnapshot(std::string_view snapshotName,
+                       std::span<const std::byte> actual,
+                       TestResult &result,
+                       const char *fileName = __FILE__,
+                       unsigned int lineNumber = __LINE__) -> bool;
+
+    auto checkSnapshot(std::string_view snapshotName,
+                       std::string_view actual,
+                       TestResult &result,
+                       const char *fileName = __FILE__,
+                       unsigned int lineNumber = __LINE__) -> bool {
+        return checkSnapshot(snapshotName, std::as_bytes(std::span(actual)), result, fileName, lineNumber);
+    }
+
+    static void countCheck(TestResult &result);
+
+    static auto messagesOf(TestResult &result) -> MessageArena &;
+
+    /// Report a failure whose message already lives in result's arena.
+    auto recordFailure(TestResult &result,
+                       std::string_view message,
+                       const char *fileName,
+                       unsigned int lineNumber) -> bool;
+
+    /// Report the failure "before expected between actual".
+    auto recordComparison(TestResult &result,
+                          const char *before,
+                          const FormattedValue &expected,
+                          const char *between,
+                          const FormattedValue &actual,
+                          const char *fileName,
+                          unsigned int lineNumber) -> bool;
+
+    /**
+     * Report ranges that differ: their sizes if those differ, the first
+     * differing elements, and the elements on either side of difference.
+     */
+    auto recordRangeMismatch(TestResult &result,
+                             const RangeView &expected,
+                             const RangeView &actual,
+                             std::size_t difference,
+                             const char *fileName,
+                             unsigned int lineNumber) -> bool;
+
+    /// Index of the first of length bytes at which expected and actual
+    /// differ, or length if they are the same.
+    static auto firstDifferingByte(const void *expected, const void *actual, std::size_t length) -> std::size_t;
+
+    /**
+     * Compare two arrays of floating point numbers element by element with
+     * SIMD loops, recording at most one failure: how many elements are out
+     * of tolerance, the largest error and where it is, and the RMS error.
+     */
+    auto checkAllApproxEqual(std::span<const float> expected,
+                             std::span<const float> actual,
+                             const ApproxTolerance &tolerance,
+                             TestResult &result,
+                             const char *fileName = __FILE__,
+                             unsigned int lineNumber = __LINE__) -> bool;
+
+    auto checkAllApproxEqual(std::span<const double> expected,
+                             std::span<const double> actual,
+                             const ApproxTolerance &tolerance,
+                             TestResult &result,
+                             const char *fileName = __FILE__,
+                             unsigned int lineNumber = __LINE__) -> bool;
+
 private:
     template<typename SubjectType>
     static SubjectType abs(SubjectType x) { return x < 0 ? -x : x; }
 
-    std::string testName;
-    Test *nextTest;
+    template<typename Real>
+    auto checkAllApproxEqualImplementation(std::span<const Real> expected,
+                                           std::span<const Real> actual,
+                                           const ApproxTolerance &tolerance,
+                                           TestResult &result,
+                                           const char *fileName,
+                                           unsigned int lineNumber) -> bool;
+
+    template<typename ExpectedRange, typename ActualRange>
+    auto checkRangeEqual(const ExpectedRange &expected,
+                         const ActualRange &actual,
+                         TestResult &result,
+                         const char *fileName,
+                         unsigned int lineNumber) -> bool {
+        countCheck(result);
+        using ExpectedElement = std::remove_cvref_t<decltype(*std::begin(expected))>;
+        using ActualElement = std::remove_cvref_t<decltype(*std::begin(actual))>;
+        const std::size_t expectedSize = std::size(expected);
+        const std::size_t actualSize = std::size(actual);
+        const std::size_t common = expectedSize < actualSize ? expectedSize : actualSize;
+
+        std::size_t difference = 0;
+        if constexpr (std::is_same_v<ExpectedElement, ActualElement> &&
+                      std::is_scalar_v<ExpectedElement> &&
+                      std::has_unique_object_representations_v<ExpectedElement> &&
+                      requires { requires std::is_pointer_v<decltype(std::data(expected))>;
+                                 requires std::is_pointer_v<decltype(std::data(actual))>; }) {
+            // Such scalars are equal exactly when their bytes are; a class
+            // may define an operator== that is not.
+            difference = firstDifferingByte(std::data(expected), std::data(actual),
+                                            common * sizeof(ExpectedElement)) / sizeof(ExpectedElement);
+        } else {
+            auto expectedElement = std::begin(expected);
+            auto actualElement = std::begin(actual);
+            while (difference < common && *expectedElement == *actualElement) {
+                ++expectedElement;
+                ++actualElement;
+                ++difference;
+            }
+        }
+
+        bool successful = difference == common && expectedSize == actualSize;
+        if (!successful) {
+            recordRangeMismatch(result,
+                                RangeView{&expected, expectedSize, &printRangeElement<ExpectedRange>},
+                                RangeView{&actual, actualSize, &printRangeElement<ActualRange>},
+                                difference, fileName, lineNumber);
+        }
+        return successful;
+    }
+
+    /// Bytes print as numbers rather than characters.
+    template<typename RangeType>
+    static void printRangeElement(MessageStream &out, const void *range, std::size_t index) {
+        auto position = std::begin(*static_cast<const RangeType *>(range));
+        if constexpr (requires { position += static_cast<std::ptrdiff_t>(index); }) {
+            position += static_cast<std::ptrdiff_t>(index);
+        } else {
+            for (std::size_t step = 0; step < index; ++step) ++position;
+        }
+        const auto &element = *position;
+        using ElementType = std::remove_cvref_t<decltype(element)>;
+        if constexpr (std::is_integral_v<ElementType> && sizeof(ElementType) == 1) {
+            FormattedValue(static_cast<int>(element)).print(out);
+        } else {
+            FormattedValue(element).print(out);
+        }
+    }
+
+    const char *groupName;
+    const char *testName;
+    const char *fileName;
+    unsigned int lineNumber;
+    double timeoutSeconds = 0.0;
 };
 
 
 /**
  *  Record everything knowable about the circumstance and
  *  location of a failure.
+ *
+ *  A Failure only refers to its strings.  The test and file names are
+ *  static; the message lives in the MessageArena of the TestResult the
+ *  failure was reported to, so a collector may keep Failures, by value,
+ *  for as long as it lives.
  */
 struct Failure {
-    Failure(std::string theTestName,
-            std::string theFileName,
+    Failure(std::string_view theTestName,
+            std::string_view theFileName,
             unsigned int theLineNumber,
-            std::string theCondition)
-            : message(std::move(theCondition)),
-              testName(std::move(theTestName)),
-              fileName(std::move(theFileName)),
+            std::string_view theCondition)
+            : message(theCondition),
+              testName(theTestName),
+              fileName(theFileName),
               lineNumber(theLineNumber) {}
 
-    std::string message;
-    std::string testName;
-    std::string fileName;
+    std::string_view message;
+    std::string_view testName;
+    std::string_view fileName;
     unsigned int lineNumber;
 };
 
 
+/**
+ *  Timing of one benchmark: samples runs of iterations each.  Times are in
+ *  nanoseconds per iteration, throughputs per second and zero unless the
+ *  benchmark declared the bytes or items it processes per iteration.
+ */
+struct BenchmarkStats {
+    std::string_view name;
+    unsigned long long iterations = 0;
+    unsigned int samples = 0;
+    double mean = 0.0;
+    double median = 0.0;
+    double stddev = 0.0;
+    double bytesPerSecond = 0.0;
+    double itemsPerSecond = 0.0;
+};
+
+
+/**
+ *  How fast the threads of a ConcurrentTest ran its body, in runs per
+ *  second, one entry per thread.
+ */
+struct ThroughputStats {
+    std::string_view name;
+    unsigned int threads = 0;
+    unsigned long long iterations = 0;  ///< runs of the body by each thread
+    double seconds = 0.0;               ///< from the start barrier until the last thread finished
+    std::span<const double> opsPerSecond;
+};
+
+
+/**
+ *  CPU events of the thread that ran one test, read through
+ *  perf_event_open on Linux when RunOptions::counters is set.  The
+ *  hardware counts are valid when hardware is true; containers and virtual
+ *  machines often deny those, leaving only the software counts, valid when
+ *  software is true.  Counts are scaled up if the kernel had to multiplex
+ *  the counters.
+ */
+struct PerfCounts {
+    bool hardware = false;
+    bool software = false;
+    unsigned long long cycles = 0;
+    unsigned long long instructions = 0;
+    unsigned long long branchMisses = 0;
+    unsigned long long cacheMisses = 0;
+    unsigned long long taskClockNanoseconds = 0;
+    unsigned long long pageFaults = 0;
+    unsigned long long contextSwitches = 0;
+};
+
+
+/**
+ *  What TestRegistry measured while running one test.  The times are in
+ *  seconds; cpuSeconds is the CPU time of the thread that ran the test.
+ *  The allocation counts are zero unless allocations are tracked (see
+ *  AllocationCounts) and include what recording the test's failures
+ *  took; liveAllocations are those the test did not free, a sign of a
+ *  leak.
+ */
+struct TestStats {
+    double wallSeconds = 0.0;       ///< not counting setupSeconds and teardownSeconds
+    double setupSeconds = 0.0;      ///< spent constructing fixtures
+    double teardownSeconds = 0.0;   ///< spent destroying fixtures
+    double cpuSeconds = 0.0;
+    unsigned long checks = 0;
+    unsigned long failures = 0;
+    unsigned long long allocations = 0;
+    unsigned long long allocatedBytes = 0;
+    long long liveAllocations = 0;
+    PerfCounts counters;
+};
+
+
 /**
  *  Collect all of the results of tests and checks.
+ *
+ *  TestRegistry calls testStarted() before and testEnded() after each
+ *  test.  In a parallel or isolated run the calls arrive, with the test's
+ *  failures between them, when the test's results are replayed in order.
  */
 class TestResult {
 public:
-    TestResult() : failureCount(0) {}
+    TestResult() : failureCount(0), checkCount(0), failedCheckCount(0), cachedCount(0), slowestLength(0),
+                   allocationsReported(false), countersReported(false), printed(false) {}
 
-    virtual ~TestResult() = default;
+    virtual ~TestResult();
 
-    virtual void addFailure(const Failure &failure) {
-        std::cout << failure.fileName << ":" << failure.lineNumber << ":0 test \"" << failure.message << "\" failed"
-                  << std::endl;
-        addFailureCount();
-    }
+    /**
+     * Print file:line:0 test "message" failed.  The line is queued for a
+     * background writer, which prints in batches at the end of each test,
+     * when enough lines are waiting, and in testsEnded().
+     */
+    virtual void addFailure(const Failure &failure);
 
-    virtual void testsEnded() {
-        if (failureCount > 0) {
-            std::cout << "There were " << failureCount << " failures" << std::endl;
-        } else {
-            std::cout << "There were no test failures" << std::endl;
-        }
+    virtual void addBenchmark(const BenchmarkStats &stats);
+
+    virtual void addThroughput(const ThroughputStats &stats);
+
+    virtual void testStarted(const Test &) {}
+
+    virtual void testEnded(const Test &test, const TestStats &stats);
+
+    /// In place of testStarted() and testEnded() for a test skipped
+    /// because it passed before; see RunOptions::cacheFile.
+    virtual void testCached(const Test &test);
+
+    virtual void testsEnded();
+
+    /**
+     * Have testsEnded() list the count slowest tests and the total time of
+     * each test group, with the time its fixtures took to set up and tear
+     * down.
+     */
+    void reportSlowest(unsigned int count) { slowestLength = count; }
+
+    /**
+     * Have testsEnded() list the allocations, bytes allocated and
+     * allocations left live of every test that allocated.
+     */
+    void reportAllocations(bool report) { allocationsReported = report; }
+
+    /// Have testsEnded() total the performance counters of each test group.
+    void reportCounters(bool report) { countersReported = report; }
+
+    /// Number of checks made and failures recorded through this result.
+    [[nodiscard]] auto checks() const -> unsigned long { return checkCount; }
+
+    [[nodiscard]] auto failedChecks() const -> unsigned long { return failedCheckCount; }
+
+    void countChecks(unsigned long checked, unsigned long failed) {
+        checkCount += checked;
+        failedCheckCount += failed;
     }
 
+    /// Where the messages of the failures reported to this result live.
+    auto messages() -> MessageArena & { return messageArena; }
+
 protected:
     auto addFailureCount(int increment = 1) -> int {
         failureCount += increment;
         return failureCount;
     }
 
+    /// Queue text, which must live in messages(), for the console writer.
+    void print(std::string_view text);
+
+    /// Once the console has printed them, drop the messages of the tests
+    /// ended so far, for a result that keeps no Failure past testEnded().
+    void releaseMessages();
+
 private:
+    void printTimingSummary();
+
+    void printAllocationSummary();
+
+    void printCounterSummary();
+
     int failureCount;
+    unsigned long checkCount;
+    unsigned long failedCheckCount;
+    unsigned long cachedCount;
+    unsigned int slowestLength;
+    MessageArena messageArena;
+    std::vector<std::pair<double, const Test *>> slowestTests;
+    struct GroupSeconds {
+        double test = 0.0;
+        double setup = 0.0;
+        double teardown = 0.0;
+    };
+    std::vector<std::pair<std::string, GroupSeconds>> groupSeconds;  ///< sorted by group
+    bool allocationsReported;
+    std::vector<std::pair<const Test *, TestStats>> allocatingTests;
+    bool countersReported;
+    std::vector<std::pair<std::string, PerfCounts>> groupCounters;   ///< sorted by group
+    bool printed;
 };
 
 
-inline auto
-Test::fail(TestResult &result,
-           const char *conditionString,
-           const char *fileName,
-           unsigned int lineNumber) -> bool {
-    result.addFailure(Failure(testName, fileName, lineNumber, conditionString));
-    return false;
+/**
+ *  The file a reporter given a file name writes: created or truncated when
+ *  the ReportFile is constructed, and closed when it is destroyed.
+ */
+class ReportFile {
+public:
+    ReportFile() = default;
+
+    /// Throws std::runtime_error if fileName cannot be opened.
+    explicit ReportFile(const std::string &fileName);
+
+    ReportFile(const ReportFile &) = delete;
+
+    auto operator=(const ReportFile &) -> ReportFile & = delete;
+
+    ~ReportFile();
+
+    [[nodiscard]] auto stream() const -> std::ostream & { return *file; }
+
+private:
+    std::ostream *file = nullptr;
+};
+
+
+/**
+ *  Write the results as JUnit XML, one testcase element per test, while
+ *  the tests run.  Only the failures of the current test, and their
+ *  messages, are held in memory, so a run of any length needs the same
+ *  space.  The counts of tests, failures and skipped tests are filled in
+ *  on the testsuite element when the run ends, if the output can seek
+ *  back to it, as a file can.  The failures are printed on the console
+ *  as well.
+ */
+class JUnitXmlResult : public TestResult {
+public:
+    /// Write to fileName, which is created or truncated; throws
+    /// std::runtime_error if it cannot be opened.
+    explicit JUnitXmlResult(const std::string &fileName);
+
+    explicit JUnitXmlResult(std::ostream &output);
+
+    ~JUnitXmlResult() override;
+
+    void addFailure(const Failure &failure) override;
+
+    void testEnded(const Test &test, const TestStats &stats) override;
+
+    void testCached(const Test &test) override;
+
+    void testsEnded() override;
+
+private:
+    void start();
+
+    ReportFile file;
+    std::ostream &out;
+    std::string failures;
+    long long suiteCounts = -1;  ///< where the counts go in out, or -1 if it cannot seek
+    unsigned long testCount = 0;
+    unsigned long failedCount = 0;
+    unsigned long skippedCount = 0;
+};
+
+
+/**
+ *  Write the results as JSON lines, one object per line:
+ *
+ *  - per test run, its group, test, passed, seconds, fixture setup and
+ *    teardown seconds if any, checks, and failures, each with file, line
+ *    and message;
+ *  - per test skipped by the result cache, its group and test with
+ *    passed and cached both true;
+ *  - per benchmark, its name, iterations, samples, meanNs, medianNs,
+ *    stddevNs, bytesPerSecond and itemsPerSecond;
+ *  - per CONCURRENT_TEST, as "concurrent", its name, threads,
+ *    iterations, seconds and the opsPerSecond of each thread.
+ *
+ *  Each line is written when its test ends, after which its failure
+ *  messages are dropped.  The failures are printed on the console as
+ *  well.
+ */
+class JsonLinesResult : public TestResult {
+public:
+    /// Write to fileName, which is created or truncated; throws
+    /// std::runtime_error if it cannot be opened.
+    explicit JsonLinesResult(const std::string &fileName);
+
+    explicit JsonLinesResult(std::ostream &output);
+
+    ~JsonLinesResult() override;
+
+    void addFailure(const Failure &failure) override;
+
+    void addBenchmark(const BenchmarkStats &stats) override;
+
+    void addThroughput(const ThroughputStats &stats) override;
+
+    void testEnded(const Test &test, const TestStats &stats) override;
+
+    void testCached(const Test &test) override;
+
+    void testsEnded() override;
+
+private:
+    ReportFile file;
+    std::ostream &out;
+    std::string failures;
+};
+
+
+/**
+ *  Handed to a benchmark body, which repeats the code being measured
+ *  while keepRunning() returns true:
+ *
+ *  BENCHMARK(Parser, ParseSmallDocument)
+ *  {
+ *     state.setBytesPerIteration(sizeof document);
+ *     while (state.keepRunning()) doNotOptimize(parse(document));
+ *  }
+ */
+class BenchmarkState {
+public:
+    explicit BenchmarkState(unsigned long long theIterations)
+            : iterations(theIterations), remaining(theIterations) {}
+
+    inline auto keepRunning() -> bool {
+        if (remaining == iterations) start();
+        if (remaining == 0) {
+            stop();
+            return false;
+        }
+        --remaining;
+        return true;
+    }
+
+    void setBytesPerIteration(unsigned long long bytes) { bytesPerIteration = bytes; }
+
+    void setItemsPerIteration(unsigned long long items) { itemsPerIteration = items; }
+
+    [[nodiscard]] auto elapsedNanoseconds() const -> long long { return stopped - started; }
+
+    [[nodiscard]] auto bytes() const -> unsigned long long { return bytesPerIteration; }
+
+    [[nodiscard]] auto items() const -> unsigned long long { return itemsPerIteration; }
+
+private:
+    void start();
+
+    void stop();
+
+    unsigned long long iterations;
+    unsigned long long remaining;
+    unsigned long long bytesPerIteration = 0;
+    unsigned long long itemsPerIteration = 0;
+    long long started = 0;
+    long long stopped = 0;
+};
+
+
+/**
+ *  Inherit from Benchmark, or use the BENCHMARK macro, to measure code.
+ *  run() calibrates the iteration count until a sample takes about ten
+ *  milliseconds, times twenty samples and reports them through
+ *  TestResult::addBenchmark().
+ */
+class Benchmark : public Test {
+public:
+    explicit Benchmark(const char *theBenchmarkName) : Test(theBenchmarkName) {}
+
+    Benchmark(const char *theGroupName, const char *theBenchmarkName) : Test(theGroupName, theBenchmarkName) {}
+
+    Benchmark(const char *theGroupName, const char *theBenchmarkName, const char *theFileName, unsigned int theLineNumber)
+            : Test(theGroupName, theBenchmarkName, theFileName, theLineNumber) {}
+
+    explicit Benchmark(const TestEntry &entry) : Test(entry) {}
+
+    void run(TestResult &result) final;
+
+    /**
+     * Override benchmark() with the code to measure.
+     */
+    virtual void benchmark(BenchmarkState &state) = 0;
+
+    [[nodiscard]] auto isBenchmark() const -> bool final { return true; }
+
+protected:
+    /// Keep the compiler from discarding the computation of value.
+    template<typename ValueType>
+    static void doNotOptimize(const ValueType &value) {
+#if defined(__GNUC__)
+        asm volatile("" : : "r,m"(value) : "memory");
+#else
+        escape(&value);
+#endif
+    }
+
+    /// Make the compiler assume every object in memory was read and written.
+    static void clobberMemory() {
+#if defined(__GNUC__)
+        asm volatile("" : : : "memory");
+#else
+        escape(nullptr);
+#endif
+    }
+
+private:
+    static void escape(const volatile void *pointer);
+};
+
+
+/**
+ *  Inherit from ConcurrentTest, or use CONCURRENT_TEST, to run code from
+ *  several threads at once.  run() starts threads() threads, holds them at
+ *  a barrier until all have started and then has each call work() with
+ *  its index.  Each thread checks into a result of its own, which run()
+ *  replays into the test's result once the threads have joined, so checks
+ *  need no locks.  run() finishes by reporting the throughput of every
+ *  thread through TestResult::addThroughput().
+ */
+class ConcurrentTest : public Test {
+public:
+    ConcurrentTest(const TestEntry &entry, unsigned int theThreads, unsigned long long theIterations)
+            : Test(entry), threadCount(theThreads), iterationCount(theIterations) {}
+
+    void run(TestResult &result) final;
+
+    /**
+     * Override work() with the code for thread threadIndex to run
+     * iterations() times, calling maybeYield() between runs.
+     */
+    virtual void work(TestResult &result, unsigned int threadIndex) = 0;
+
+    [[nodiscard]] auto threads() const -> unsigned int { return threadCount; }
+
+    [[nodiscard]] auto iterations() const -> unsigned long long { return iterationCount; }
+
+    /// TestRegistry::runAll() passes on RunOptions::pinThreads and yieldOneIn.
+    static void configure(bool pinThreads, unsigned int yieldOneIn);
+
+protected:
+    /// Yield the processor at random, to widen race windows, if configured to.
+    static void maybeYield() {
+        if (yieldOneIn != 0) yieldSometimes();
+    }
+
+private:
+    static void yieldSometimes();
+
+    static inline bool pinned = false;
+    static inline unsigned int yieldOneIn = 0;
+
+    unsigned int threadCount;
+    unsigned long long iterationCount;
+};
+
+
+/**
+ *  A file mapped read only into memory, or read into it where there is
+ *  no mmap().  The mapping, and every view of it, lasts until the
+ *  MappedFile is closed or destroyed.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    MappedFile(MappedFile &&other) noexcept;
+
+    MappedFile(const MappedFile &) = delete;
+
+    auto operator=(MappedFile other) noexcept -> MappedFile &;
+
+    ~MappedFile() { close(); }
+
+    /// Map path, closing what was mapped before; false, with errno set, if it cannot be.
+    auto open(const std::string &path) -> bool;
+
+    void close();
+
+    [[nodiscard]] auto bytes() const -> std::span<const std::byte> { return {mapped, length}; }
+
+    [[nodiscard]] auto size() const -> std::size_t { return length; }
+
+    [[nodiscard]] auto text() const -> std::string_view {
+        return {reinterpret_cast<const char *>(mapped), length};
+    }
+
+private:
+    const std::byte *mapped = nullptr;
+    std::size_t length = 0;
+    bool unmap = false;  ///< else mapped was allocated with new[]
+};
+
+
+/**
+ *  How a TEST_DATA file divides into records: either records of
+ *  recordSize bytes, or rows that each end with delimiter (the last row
+ *  may go without).  Rows are lines by default, and a line loses the
+ *  carriage return that ends it, if any.
+ */
+struct DataFormat {
+    constexpr DataFormat() = default;
+
+    constexpr DataFormat(std::size_t theRecordSize) : recordSize(theRecordSize) {}
+
+    static constexpr auto delimited(char theDelimiter) -> DataFormat {
+        DataFormat format;
+        format.delimiter = theDelimiter;
+        return format;
+    }
+
+    std::size_t recordSize = 0;  ///< 0 for delimited rows
+    char delimiter = '\n';
+};
+
+
+/// One record of a TEST_DATA file, viewed where it is mapped.
+class DataRecord {
+public:
+    DataRecord(std::size_t theIndex, std::span<const std::byte> theBytes) : recordIndex(theIndex), view(theBytes) {}
+
+    /// Where the record is in the file, counting from 0.
+    [[nodiscard]] auto index() const -> std::size_t { return recordIndex; }
+
+    [[nodiscard]] auto bytes() const -> std::span<const std::byte> { return view; }
+
+    [[nodiscard]] auto text() const -> std::string_view {
+        return {reinterpret_cast<const char *>(view.data()), view.size()};
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return view.size(); }
+
+    /// The T stored at offset, which need not be aligned for it.
+    template<typename T>
+    [[nodiscard]] auto field(std::size_t offset) const -> T {
+        static_assert(std::is_trivially_copyable_v<T>, "field() copies the bytes of a T");
+        if (offset > view.size() || view.size() - offset < sizeof(T)) throw std::out_of_range("DataRecord::field");
+        T value;
+        copyBytes(&value, view.data() + offset, sizeof(T));
+        return value;
+    }
+
+private:
+    static void copyBytes(void *target, const std::byte *source, std::size_t length);
+
+    std::size_t recordIndex;
+    std::span<const std::byte> view;
+};
+
+
+/**
+ *  Inherit from DataTest, or use TEST_DATA, to check every record of a
+ *  file of test vectors.  run() maps the file, found as given or else
+ *  next to the source file that declared the test, and calls
+ *  checkRecord() once for each record.  A large file is split into runs
+ *  of records, up to one for each job (see RunOptions::jobs) and a
+ *  megabyte or more each, checked by threads of their own, so
+ *  checkRecord() must not change the test.  Each failure is reported
+ *  with the index of its record.
+ */
+class DataTest : public Test {
+public:
+    DataTest(const TestEntry &entry, const char *thePath, DataFormat theFormat)
+            : Test(entry), dataPath(thePath), format(theFormat) {}
+
+    void run(TestResult &result) final;
+
+    virtual void checkRecord(TestResult &result, const DataRecord &record) = 0;
+
+    [[nodiscard]] auto path() const -> const char * { return dataPath; }
+
+    /// The file path() names, found as run() finds it.
+    [[nodiscard]] auto dataFile() const -> std::string;
+
+    [[nodiscard]] auto inputs() const -> std::vector<std::string> override { return {dataFile()}; }
+
+    /// TestRegistry::runAll() passes on how many jobs it was given.
+    static void configure(unsigned int theWorkers) { workers = theWorkers != 0 ? theWorkers : 1; }
+
+private:
+    static inline unsigned int workers = 1;
+
+    const char *dataPath;
+    DataFormat format;
+};
+
+
+/// What the checks of a CONSTEXPR_TEST record: how many ran, and the
+/// text of the one running.
+struct ConstexprResult {
+    unsigned int checks = 0;
+    const char *expression = nullptr;
+};
+
+
+/**
+ *  The check macros pass their result through describeCheck() with the
+ *  text of the check.  At run time the text is not wanted and the result
+ *  passes through unchanged; in a CONSTEXPR_TEST it is kept for the
+ *  diagnostic of a failing check.
+ */
+inline auto describeCheck(TestResult &result, const char *) -> TestResult & { return result; }
+
+constexpr auto describeCheck(ConstexprResult &result, const char *expression) -> ConstexprResult & {
+    result.expression = expression;
+    return result;
+}
+
+
+/**
+ *  The checks a CONSTEXPR_TEST makes while the compiler evaluates it.  A
+ *  check that fails calls failed(), which is not constexpr, so the test
+ *  does not compile; the compiler names the check with its arguments, its
+ *  text as written, such as CHECK_EQUAL(4, gcd(12, 8)), and the file and
+ *  line.
+ */
+class ConstexprChecks {
+protected:
+    static constexpr auto check(ConstexprResult &result,
+                                bool condition,
+                                const char *conditionString,
+                                const char *fileName,
+                                unsigned int lineNumber) -> bool {
+        ++result.checks;
+        if (!condition) failed(conditionString, fileName, lineNumber);
+        return condition;
+    }
+
+    static constexpr auto fail(ConstexprResult &result,
+                               const char *conditionString,
+                               const char *fileName,
+                               unsigned int lineNumber) -> bool {
+        return check(result, false, conditionString, fileName, lineNumber);
+    }
+
+    template<typename SubjectType> requires (!CheckableRange<SubjectType>)
+    static constexpr auto checkEqual(SubjectType expected,
+                                     SubjectType actual,
+                                     ConstexprResult &result,
+                                     const char *fileName,
+                                     unsigned int lineNumber) -> bool {
+        return check(result, expected == actual, result.expression, fileName, lineNumber);
+    }
+
+    /// Strings compare by their characters, as at run time.
+    static constexpr auto checkEqual(const char *expected,
+                                     const char *actual,
+                                     ConstexprResult &result,
+                                     const char *fileName,
+                                     unsigned int lineNumber) -> bool {
+        return check(result, std::string_view(expected) == std::string_view(actual),
+                     result.expression, fileName, lineNumber);
+    }
+
+    template<CheckableRange ExpectedRange, CheckableRange ActualRange>
+    static constexpr auto checkEqual(const ExpectedRange &expected,
+                                     const ActualRange &actual,
+                                     ConstexprResult &result,
+                                     const char *fileName,
+                                     unsigned int lineNumber) -> bool {
+        bool equal = std::size(expected) == std::size(actual);
+        auto actualElement = std::begin(actual);
+        for (auto expectedElement = std::begin(expected); equal && expectedElement != std::end(expected);
+             ++expectedElement, ++actualElement) {
+            equal = *expectedElement == *actualElement;
+        }
+        return check(result, equal, result.expression, fileName, lineNumber);
+    }
+
+    template<typename SubjectType>
+    static constexpr auto checkLE(SubjectType expected,
+                                  SubjectType actual,
+                                  ConstexprResult &result,
+                                  const char *fileName,
+                                  unsigned int lineNumber) -> bool {
+        return check(result, expected <= actual, result.expression, fileName, lineNumber);
+    }
+
+    template<typename SubjectType>
+    static constexpr auto checkLT(SubjectType expected,
+                                  SubjectType actual,
+                                  ConstexprResult &result,
+                                  const char *fileName,
+                                  unsigned int lineNumber) -> bool {
+        return check(result, expected < actual, result.expression, fileName, lineNumber);
+    }
+
+    template<typename SubjectType>
+    static constexpr auto checkGT(SubjectType expected,
+                                  SubjectType actual,
+                                  ConstexprResult &result,
+                                  const char *fileName,
+                                  unsigned int lineNumber) -> bool {
+        return check(result, expected > actual, result.expression, fileName, lineNumber);
+    }
+
+    template<typename SubjectType>
+    static constexpr auto checkGE(SubjectType expected,
+                                  SubjectType actual,
+                                  ConstexprResult &result,
+                                  const char *fileName,
+                                  unsigned int lineNumber) -> bool {
+        return check(result, expected >= actual, result.expression, fileName, lineNumber);
+    }
+
+    template<typename SubjectType>
+    static constexpr auto checkApproxEqual(SubjectType expected,
+                                           SubjectType actual,
+                                           SubjectType threshold,
+                                           ConstexprResult &result,
+                                           const char *fileName,
+                                           unsigned int lineNumber) -> bool {
+        SubjectType difference = expected < actual ? actual - expected : expected - actual;
+        return check(result, difference <= threshold, result.expression,
+                     fileName, lineNumber);
+    }
+
+private:
+    static void failed(const char *conditionString, const char *fileName, unsigned int lineNumber);
+};
+
+
+/**
+ *  The test CONSTEXPR_TEST registers for the Declared test it defines.
+ *  Its run() only counts the checks the compiler already made.  The
+ *  compiler evaluates Declared::evaluate() where it instantiates run(),
+ *  at the end of the translation unit, after the body of the test.
+ */
+template<typename Declared>
+class ConstexprTest : public Test {
+public:
+    explicit ConstexprTest(const TestEntry &entry) : Test(entry) {}
+
+    void run(TestResult &result) override;
+};
+
+
+template<typename Declared>
+void ConstexprTest<Declared>::run(TestResult &result) {
+    constexpr unsigned int checks = Declared::evaluate();
+    result.countChecks(checks, 0);
+}
+
+
+/**
+ *  Times the construction or destruction of a fixture, from construction
+ *  to destruction of the timer, and adds it to the setup or teardown time
+ *  of the test running on this thread.  A timer inside another one, as
+ *  for a SharedFixture member of a TEST_F fixture, adds nothing.
+ *
+ *  A timer given the test whose fixture it times makes that test, while
+ *  it lives, the one the SharedFixture members of the fixture belong to.
+ */
+class FixtureTimer {
+public:
+    enum class Phase { setup, teardown };
+
+    explicit FixtureTimer(Phase thePhase, const Test *theTest = nullptr);
+
+    FixtureTimer(const FixtureTimer &) = delete;
+
+    auto operator=(const FixtureTimer &) -> FixtureTimer & = delete;
+
+    ~FixtureTimer();
+
+    /// The test of the innermost timer on this thread given one, if any.
+    static auto fixtureTest() -> const Test *;
+
+private:
+    Phase phase;
+    long long started;
+    const Test *outerTest;
+};
+
+
+/**
+ *  The test TEST_F registers for the Declared test it defines.  Each
+ *  run() constructs a Declared, and with it a fresh fixture, runs it and
+ *  destroys it; the construction and destruction count as setup and
+ *  teardown rather than test time.
+ */
+template<typename Declared>
+class FixtureTest : public Test {
+public:
+    explicit FixtureTest(const TestEntry &entry) : Test(entry) {}
+
+    void run(TestResult &result) override {
+        // In place, as a test checking its allocations would not expect
+        // one for its fixture.
+        alignas(Declared) unsigned char storage[sizeof(Declared)];
+        Declared *test;
+        {
+            FixtureTimer timer(FixtureTimer::Phase::setup, this);
+            test = ::new (static_cast<void *>(storage)) Declared(Declared::entry);
+        }
+        struct Teardown {
+            Declared *test;
+
+            ~Teardown() {
+                FixtureTimer timer(FixtureTimer::Phase::teardown);
+                test->~Declared();
+            }
+        } teardown{test};
+        test->run(result);
+    }
+};
+
+
+/**
+ *  The one object of a SharedFixture type, counting its references.  The
+ *  object is constructed by the first acquire() and destroyed by the
+ *  release() of the last reference, each timed as setup or teardown of
+ *  the test running at the time.
+ *
+ *  When acquire() is given a test run by TestRegistry, the test's group
+ *  takes a reference of its own, which it releases when the last of its
+ *  tests selected for the run has ended.  So the object lives from the
+ *  first test of the group that uses it until the last test of the group,
+ *  however the tests are spread over workers, threads and coroutines.
+ */
+class SharedFixtureState {
+public:
+    SharedFixtureState();
+
+    SharedFixtureState(const SharedFixtureState &) = delete;
+
+    auto operator=(const SharedFixtureState &) -> SharedFixtureState & = delete;
+
+    auto acquire(const Test *test) -> void *;
+
+    void release();
+
+protected:
+    ~SharedFixtureState();
+
+private:
+    /// Holds the std::mutex guarding object and references, so that this
+    /// header need not include <mutex>.
+    struct Lock;
+
+    virtual auto create() -> void * = 0;
+
+    virtual void destroy(void *object) = 0;
+
+    Lock *lock;
+    void *object = nullptr;
+    unsigned long references = 0;
+};
+
+
+/**
+ *  A reference to the one Type object shared by the tests that use it;
+ *  Type is default constructed when first needed.  Make it a member of a
+ *  TEST_F fixture so the tests of the group share, say, a table that takes
+ *  long to load:
+ *
+ *    struct LookupTest {
+ *       SharedFixture<LookupTable> table;
+ *    };
+ *
+ *    TEST_F(LookupTest, FindsFirstKey)
+ *    {
+ *       CHECK(table->find(1) != nullptr);
+ *    }
+ *
+ *  In a test body, as of a CONCURRENT_TEST or an ASYNC_TEST, name the
+ *  test whose group shares it:
+ *
+ *    SharedFixture<LookupTable> table(*this);
+ *
+ *  Workers running tests in parallel may share the object; Type must make
+ *  whatever they do with it safe.
+ */
+template<typename Type>
+class SharedFixture {
+public:
+    /// Shared with the group of the TEST_F whose fixture this is a member of.
+    SharedFixture() : object(static_cast<Type *>(state().acquire(FixtureTimer::fixtureTest()))) {}
+
+    /// Shared with the group of test.
+    explicit SharedFixture(const Test &test) : object(static_cast<Type *>(state().acquire(&test))) {}
+
+    SharedFixture(const SharedFixture &) = delete;
+
+    auto operator=(const SharedFixture &) -> SharedFixture & = delete;
+
+    ~SharedFixture() { state().release(); }
+
+    auto operator*() const -> Type & { return *object; }
+
+    auto operator->() const -> Type * { return object; }
+
+private:
+    struct State final : SharedFixtureState {
+        auto create() -> void * override { return new Type(); }
+
+        void destroy(void *shared) override { delete static_cast<Type *>(shared); }
+    };
+
+    static auto state() -> State & {
+        static State shared;
+        return shared;
+    }
+
+    Type *object;
+};
+
+
+inline void
+Test::countCheck(TestResult &result) {
+    result.countChecks(1, 0);
+}
+
+
+inline auto
+Test::messagesOf(TestResult &result) -> MessageArena & {
+    return result.messages();
+}
+
+
+inline auto
+Test::recordFailure(TestResult &result,
+                    std::string_view message,
+                    const char *fileName,
+                    unsigned int lineNumber) -> bool {
+    result.countChecks(0, 1);
+    result.addFailure(Failure(testName, fileName, lineNumber, message));
+    return false;
+}
+
+
+inline auto
+Test::fail(TestResult &result,
+           const char *conditionString,
+           const char *fileName,
+           unsigned int lineNumber) -> bool {
+    return recordFailure(result, result.messages().store(conditionString), fileName, lineNumber);
 }
 
 
@@ -314,11 +1837,10 @@ auto Test::checkApproxEqual(SubjectType expected,
                        TestResult &result,
                        const char *fileName,
                        unsigned int lineNumber) -> bool {
+    countCheck(result);
     bool successful = abs(expected - actual) <= threshold;
     if (!successful) {
-        std::ostringstream message;
-        message << "expected: " << expected << " but received: " << actual;
-        fail(result, message.str().c_str(), fileName, lineNumber);
+        recordComparison(result, "expected: ", expected, " but received: ", actual, fileName, lineNumber);
     }
     return successful;
 }
@@ -0,0 +1,215 @@
+// -*- mode:C++; c-basic-offset:2; indent-tabs-mode:nil -*-
+/*
+Copyright © 2015 Glen S. Dayton
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/**
+ *  The asynchronous tests of CppUnitXLite: ASYNC_TEST bodies, the
+ *  AsyncTask coroutines they await, and what they may co_await.
+ *
+ *  #include <CppUnitXLite/CppUnitXLiteAsync.hpp>
+ *
+ *  ASYNC_TEST(Server, Echoes)
+ *  {
+ *     co_await sleepFor(std::chrono::milliseconds(10));
+ *     CHECK(serverUp());
+ *  }
+ *
+ *  Kept apart from CppUnitXLite.hpp, so that only the tests that wait pay
+ *  for <chrono> and <coroutine>.
+ */
+
+#ifndef CPP_UNIT_X_LITE_ASYNC_H_
+#define CPP_UNIT_X_LITE_ASYNC_H_
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "CppUnitXLite.hpp"
+
+
+/**
+ *  The coroutine an ASYNC_TEST body is, and any coroutine the body
+ *  co_awaits.  A task starts when it is first awaited, or when the loop
+ *  running the test starts it, and resumes whoever awaited it when it
+ *  returns, rethrowing what it threw.
+ */
+class AsyncTask {
+public:
+    struct promise_type;
+
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter {
+        static auto await_ready() noexcept -> bool { return false; }
+
+        auto await_suspend(Handle finishing) noexcept -> std::coroutine_handle<>;
+
+        static void await_resume() noexcept {}
+    };
+
+    struct promise_type {
+        auto get_return_object() -> AsyncTask { return AsyncTask(Handle::from_promise(*this)); }
+
+        static auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+
+        static auto final_suspend() noexcept -> FinalAwaiter { return {}; }
+
+        static void return_void() {}
+
+        void unhandled_exception() { exception = std::current_exception(); }
+
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+        void (*finished)(void *context) = nullptr;  ///< called as a task nobody awaits returns
+        void *context = nullptr;
+    };
+
+    AsyncTask(AsyncTask &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    AsyncTask(const AsyncTask &) = delete;
+
+    auto operator=(AsyncTask other) noexcept -> AsyncTask & {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    ~AsyncTask() {
+        if (handle) handle.destroy();
+    }
+
+    [[nodiscard]] auto coroutine() const -> Handle { return handle; }
+
+    auto await_ready() const noexcept -> bool { return !handle || handle.done(); }
+
+    auto await_suspend(std::coroutine_handle<> awaiting) noexcept -> std::coroutine_handle<> {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    void await_resume() const {
+        if (handle && handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+    }
+
+private:
+    explicit AsyncTask(Handle theHandle) : handle(theHandle) {}
+
+    Handle handle;
+};
+
+
+inline auto
+AsyncTask::FinalAwaiter::await_suspend(Handle finishing) noexcept -> std::coroutine_handle<> {
+    promise_type &promise = finishing.promise();
+    if (promise.continuation) return promise.continuation;
+    if (promise.finished != nullptr) promise.finished(promise.context);
+    return std::noop_coroutine();
+}
+
+
+/**
+ *  What an ASYNC_TEST co_awaits from the loop running it: a time, a file
+ *  descriptor becoming readable or writable, or a condition the loop
+ *  tests every millisecond or so.  Awaiting one outside an AsyncTest
+ *  throws std::logic_error.
+ */
+struct AsyncWait {
+    enum class Kind { time, readable, writable, condition };
+
+    Kind kind = Kind::time;
+    long long deadline = 0;  ///< steady clock nanoseconds, for Kind::time
+    int fd = -1;
+    bool (*isReady)(const void *subject) = nullptr;
+    const void *subject = nullptr;
+
+    static auto await_ready() noexcept -> bool { return false; }
+
+    void await_suspend(std::coroutine_handle<> awaiting) const;
+
+    static void await_resume() noexcept {}
+};
+
+
+/// Waits for a std::future, or anything with wait_for() and get(), and yields get().
+template<typename Future>
+struct AsyncFutureWait : AsyncWait {
+    explicit AsyncFutureWait(Future &theFuture) : future(theFuture) {
+        kind = Kind::condition;
+        subject = &future;
+        isReady = [](const void *waited) {
+            Future &pending = *static_cast<Future *>(const_cast<void *>(waited));
+            using Status = decltype(pending.wait_for(std::chrono::seconds(0)));
+            return pending.wait_for(std::chrono::seconds(0)) == Status::ready;
+        };
+    }
+
+    auto await_ready() const -> bool { return isReady(subject); }
+
+    auto await_resume() -> decltype(std::declval<Future &>().get()) { return future.get(); }
+
+    Future &future;
+};
+
+
+/**
+ *  Inherit from AsyncTest, or use ASYNC_TEST, for a test that mostly
+ *  waits.  TestRegistry runs the selected asynchronous tests together,
+ *  interleaved on one thread by an event loop (epoll on Linux), before the
+ *  others.  Each test checks into a result of its own, replayed in order
+ *  when they have all finished, so every failure belongs to its test.
+ *  Called by itself, run() runs the test on a loop of its own.
+ *
+ *  A test that still waits when there is nothing left that could wake it
+ *  fails.
+ */
+class AsyncTest : public Test {
+public:
+    explicit AsyncTest(const TestEntry &entry) : Test(entry) {}
+
+    void run(TestResult &result) final;
+
+    /// Override body() with a coroutine; it must co_await or co_return.
+    virtual auto body(TestResult &result) -> AsyncTask = 0;
+
+    // What body(), and the AsyncTask coroutines it awaits, may co_await.
+
+    static auto sleepFor(std::chrono::nanoseconds duration) -> AsyncWait;
+
+    static auto readable(int fd) -> AsyncWait {
+        AsyncWait wait;
+        wait.kind = AsyncWait::Kind::readable;
+        wait.fd = fd;
+        return wait;
+    }
+
+    static auto writable(int fd) -> AsyncWait {
+        AsyncWait wait;
+        wait.kind = AsyncWait::Kind::writable;
+        wait.fd = fd;
+        return wait;
+    }
+
+    template<typename Future>
+    static auto ready(Future &future) -> AsyncFutureWait<Future> { return AsyncFutureWait<Future>(future); }
+};
+
+#endif // CPP_UNIT_X_LITE_ASYNC_H_
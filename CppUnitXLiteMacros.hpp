@@ -0,0 +1,262 @@
+// -*- mode:C++; c-basic-offset:2; indent-tabs-mode:nil -*-
+/*
+Copyright © 2015 Glen S. Dayton
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/**
+ *  The convenience macros TEST, CHECK and friends, apart from the
+ *  declarations they name.  CppUnitXLite.hpp includes this file; a test
+ *  using the module writes
+ *
+ *    import CppUnitXLite;
+ *    #include <CppUnitXLite/CppUnitXLiteMacros.hpp>
+ *
+ *  since a module cannot export macros.
+ */
+
+#ifndef CPP_UNIT_X_LITE_MACROS_H_
+#define CPP_UNIT_X_LITE_MACROS_H_
+
+// Registers a TestEntry.  A pointer in the section cppunitxlite costs no
+// code at startup; TestRegistry finds the section by the symbols the
+// linker defines for it.
+#if defined(__ELF__)
+#define CPP_UNIT_X_LITE_REGISTER(registration, entry) \
+[[gnu::used, gnu::section("cppunitxlite")]] static constinit const TestEntry *const registration = &(entry);
+#elif defined(__APPLE__)
+#define CPP_UNIT_X_LITE_REGISTER(registration, entry) \
+[[gnu::used, gnu::section("__DATA,cppunitxlite")]] static constinit const TestEntry *const registration = &(entry);
+#else
+#define CPP_UNIT_X_LITE_REGISTER(registration, entry) \
+[[maybe_unused]] static const bool registration = TestRegistry::addEntry(entry);
+#endif
+
+/**
+ * A test.  An optional third argument is its timeout in seconds, which
+ * takes the place of RunOptions::timeoutSeconds:
+ *
+ *   TEST(Connection, Reconnects, 5.0)
+ *   {
+ *      CHECK(connection.reconnect());
+ *   }
+ */
+#define TEST(testGroup, testName, ...)\
+class testGroup##testName##Test : public Test \
+{ public: testGroup##testName##Test () : Test (entry) {} \
+  void run (TestResult& theResult); \
+  static Test& instance () { static testGroup##testName##Test test; return test; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry testGroup##testName##Test::entry \
+{ #testGroup, #testName, __FILE__, __LINE__, false, &testGroup##testName##Test::instance __VA_OPT__(, (__VA_ARGS__)) }; \
+CPP_UNIT_X_LITE_REGISTER(testGroup##testName##Registration, testGroup##testName##Test::entry) \
+void testGroup##testName##Test::run ([[maybe_unused]] TestResult& theResult)
+
+/**
+ * A test with a fixture: a default constructible class whose members the
+ * body uses as its own.  Each run of the test constructs the fixture
+ * first and destroys it last; members of type SharedFixture are shared
+ * with the other tests of the group instead.  Like TEST, it takes an
+ * optional timeout in seconds.
+ *
+ *   struct ParserTest { Parser parser; };
+ *
+ *   TEST_F(ParserTest, ParsesEmptyDocument)
+ *   {
+ *      CHECK(parser.parse("").empty());
+ *   }
+ */
+#define TEST_F(fixture, testName, ...)\
+class fixture##testName##Test : public Test, public fixture \
+{ public: explicit fixture##testName##Test (const TestEntry& theEntry) : Test (theEntry) {} \
+  void run (TestResult& theResult); \
+  static Test& instance () { static FixtureTest<fixture##testName##Test> test (entry); return test; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry fixture##testName##Test::entry \
+{ #fixture, #testName, __FILE__, __LINE__, false, &fixture##testName##Test::instance __VA_OPT__(, (__VA_ARGS__)) }; \
+CPP_UNIT_X_LITE_REGISTER(fixture##testName##Registration, fixture##testName##Test::entry) \
+void fixture##testName##Test::run ([[maybe_unused]] TestResult& theResult)
+
+/**
+ * A test run by threadCount threads at once, each running the body
+ * iterationCount times after all have started.  The body sees the index
+ * of its thread, threadIndex, and of the run, iteration:
+ *
+ *   CONCURRENT_TEST(Queue, PushPop, 4, 100000)
+ *   {
+ *      if (threadIndex % 2 == 0) queue.push(iteration);
+ *      else CHECK(queue.pop() >= 0);
+ *   }
+ */
+#define CONCURRENT_TEST(testGroup, testName, threadCount, iterationCount)\
+class testGroup##testName##Test : public ConcurrentTest \
+{ public: testGroup##testName##Test () : ConcurrentTest (entry, (threadCount), (iterationCount)) {} \
+  void work (TestResult& theResult, unsigned int threadIndex) override \
+  { for (unsigned long long iteration = 0; iteration < iterations (); ++iteration) \
+    { maybeYield (); body (theResult, threadIndex, iteration); } } \
+  void body (TestResult& theResult, unsigned int threadIndex, unsigned long long iteration); \
+  static Test& instance () { static testGroup##testName##Test test; return test; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry testGroup##testName##Test::entry \
+{ #testGroup, #testName, __FILE__, __LINE__, false, &testGroup##testName##Test::instance }; \
+CPP_UNIT_X_LITE_REGISTER(testGroup##testName##Registration, testGroup##testName##Test::entry) \
+void testGroup##testName##Test::body ([[maybe_unused]] TestResult& theResult, [[maybe_unused]] unsigned int threadIndex, \
+                                      [[maybe_unused]] unsigned long long iteration)
+
+/**
+ * A test whose body is a coroutine, run interleaved with the other
+ * asynchronous tests on one thread.  The body may co_await
+ * sleepFor(duration), readable(fd), writable(fd), ready(future) and
+ * other AsyncTask coroutines, and must co_await or co_return at least
+ * once.  Like TEST, it takes an optional timeout in seconds.  A file
+ * defining one includes CppUnitXLiteAsync.hpp, which declares them:
+ *
+ *   ASYNC_TEST(Server, Echoes, 2.0)
+ *   {
+ *      co_await writable(socket);
+ *      send(socket, "ping", 4, 0);
+ *      co_await readable(socket);
+ *      CHECK(recv(socket, reply, sizeof reply, 0) == 4);
+ *   }
+ */
+#define ASYNC_TEST(testGroup, testName, ...)\
+class testGroup##testName##Test : public AsyncTest \
+{ public: testGroup##testName##Test () : AsyncTest (entry) {} \
+  AsyncTask body (TestResult& theResult) override; \
+  static Test& instance () { static testGroup##testName##Test test; return test; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry testGroup##testName##Test::entry \
+{ #testGroup, #testName, __FILE__, __LINE__, false, &testGroup##testName##Test::instance __VA_OPT__(, (__VA_ARGS__)) }; \
+CPP_UNIT_X_LITE_REGISTER(testGroup##testName##Registration, testGroup##testName##Test::entry) \
+AsyncTask testGroup##testName##Test::body ([[maybe_unused]] TestResult& theResult)
+
+/**
+ * A test of every record of the file at dataPath, a string literal.  An
+ * optional last argument gives the DataFormat: a record size for fixed
+ * size binary records, or DataFormat::delimited(c); rows of text are
+ * lines by default.  The body sees each record, record, in place:
+ *
+ *   TEST_DATA(Codec, DecodesVectors, "vectors.bin", 48)
+ *   {
+ *      CHECK_EQUAL(record.field<std::uint32_t>(44), crc32(record.bytes().first(44)));
+ *   }
+ */
+#define TEST_DATA(testGroup, testName, dataPath, ...)\
+class testGroup##testName##Test : public DataTest \
+{ public: testGroup##testName##Test () : DataTest (entry, dataPath, DataFormat{__VA_ARGS__}) {} \
+  void checkRecord (TestResult& theResult, const DataRecord& record) override; \
+  static Test& instance () { static testGroup##testName##Test test; return test; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry testGroup##testName##Test::entry \
+{ #testGroup, #testName, __FILE__, __LINE__, false, &testGroup##testName##Test::instance }; \
+CPP_UNIT_X_LITE_REGISTER(testGroup##testName##Registration, testGroup##testName##Test::entry) \
+void testGroup##testName##Test::checkRecord ([[maybe_unused]] TestResult& theResult, const DataRecord& record)
+
+/**
+ * A test the compiler runs: the body, with the same checks as TEST, is a
+ * constexpr function evaluated while compiling, and a failing check is a
+ * compile error.  The test is still registered, so it is listed and
+ * reported with its checks, but running it does nothing more.
+ *
+ *   CONSTEXPR_TEST(Math, Gcd)
+ *   {
+ *      CHECK_EQUAL(4, gcd(12, 8));
+ *   }
+ */
+#define CONSTEXPR_TEST(testGroup, testName)\
+class testGroup##testName##ConstexprTest : public ConstexprChecks \
+{ public: static constexpr void run (ConstexprResult& theResult); \
+  static constexpr unsigned int evaluate () { ConstexprResult theResult; run (theResult); return theResult.checks; } \
+  static Test& instance () { static ConstexprTest<testGroup##testName##ConstexprTest> test (entry); return test; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry testGroup##testName##ConstexprTest::entry \
+{ #testGroup, #testName, __FILE__, __LINE__, false, &testGroup##testName##ConstexprTest::instance }; \
+CPP_UNIT_X_LITE_REGISTER(testGroup##testName##Registration, testGroup##testName##ConstexprTest::entry) \
+constexpr void testGroup##testName##ConstexprTest::run ([[maybe_unused]] ConstexprResult& theResult)
+
+#define CHECK(condition) check(theResult, (condition), #condition, __FILE__, __LINE__)
+
+#define CHECK_EQUAL(expected, actual) checkEqual((expected), (actual), describeCheck(theResult, "CHECK_EQUAL(" #expected ", " #actual ")"), __FILE__, __LINE__)
+#define CHECK_LE(expected, actual) checkLE((expected), (actual), describeCheck(theResult, "CHECK_LE(" #expected ", " #actual ")"), __FILE__, __LINE__)
+#define CHECK_LT(expected, actual) checkLT((expected), (actual), describeCheck(theResult, "CHECK_LT(" #expected ", " #actual ")"), __FILE__, __LINE__)
+#define CHECK_GT(expected, actual) checkGT((expected), (actual), describeCheck(theResult, "CHECK_GT(" #expected ", " #actual ")"), __FILE__, __LINE__)
+#define CHECK_GE(expected, actual) checkGE((expected), (actual), describeCheck(theResult, "CHECK_GE(" #expected ", " #actual ")"), __FILE__, __LINE__)
+
+#define CHECK_APPROX_EQUAL(expected, actual, threshold) \
+checkApproxEqual((expected), (actual), (threshold), \
+                 describeCheck(theResult, "CHECK_APPROX_EQUAL(" #expected ", " #actual ", " #threshold ")"), __FILE__, __LINE__)
+
+// The tolerance may be written inline: ApproxTolerance{.absolute = 1e-6, .ulps = 4}
+#define CHECK_ALL_APPROX_EQUAL(expected, actual, ...) checkAllApproxEqual((expected), (actual), (__VA_ARGS__), theResult, __FILE__, __LINE__)
+
+#define FAIL(text) fail(theResult, (text), __FILE__, __LINE__)
+
+/**
+ * Compare bytes, a std::string_view or a span of std::byte, with the
+ * golden file snapshots/snapshotName next to this source file; run with
+ * --update-snapshots to write the golden files from the tests.
+ *
+ *   CHECK_SNAPSHOT("report.html", renderReport(results));
+ */
+#define CHECK_SNAPSHOT(snapshotName, bytes) checkSnapshot((snapshotName), (bytes), theResult, __FILE__, __LINE__)
+
+/**
+ * Check that the block which follows allocates nothing from the heap,
+ * or at most count times and bytes in all:
+ *
+ *   CHECK_NO_ALLOC { parser.reset(); }
+ *   CHECK_MAX_ALLOCATIONS(1, 4096) { parser.parse(document); }
+ *
+ * Counting needs CppUnitXLite.cpp compiled with
+ * CPP_UNIT_X_LITE_TRACK_ALLOCATIONS; otherwise these always pass.
+ */
+#define CHECK_MAX_ALLOCATIONS(count, bytes) \
+for (AllocationScope allocationScope((count), (bytes)); allocationScope.running(); \
+     checkAllocations(theResult, allocationScope, __FILE__, __LINE__))
+
+#define CHECK_NO_ALLOC CHECK_MAX_ALLOCATIONS(0, 0)
+
+/**
+ * Time the block which follows over many runs and fail if it is slower
+ * than its baseline by more than tolerance, a fraction, and by more than
+ * the noise of the two measurements explains:
+ *
+ *   CHECK_NOT_SLOWER("parse", 0.10) { parser.parse(document); }
+ *
+ * The baseline is the entry group/test/key of the file given with
+ * --baselines=PATH, which --update-baselines rewrites from this run.
+ */
+#define CHECK_NOT_SLOWER(baselineKey, tolerance) \
+for (PerformanceSample performanceSample((baselineKey), (tolerance)); \
+     performanceSample.running() || (checkNotSlower(theResult, performanceSample, __FILE__, __LINE__), false); )
+
+#define BENCHMARK(benchmarkGroup, benchmarkName)\
+class benchmarkGroup##benchmarkName##Benchmark : public Benchmark \
+{ public: benchmarkGroup##benchmarkName##Benchmark () : Benchmark (entry) {} \
+  void benchmark (BenchmarkState& state); \
+  static Test& instance () { static benchmarkGroup##benchmarkName##Benchmark benchmark; return benchmark; } \
+  static const TestEntry entry; }; \
+constinit const TestEntry benchmarkGroup##benchmarkName##Benchmark::entry \
+{ #benchmarkGroup, #benchmarkName, __FILE__, __LINE__, true, &benchmarkGroup##benchmarkName##Benchmark::instance }; \
+CPP_UNIT_X_LITE_REGISTER(benchmarkGroup##benchmarkName##BenchmarkRegistration, benchmarkGroup##benchmarkName##Benchmark::entry) \
+void benchmarkGroup##benchmarkName##Benchmark::benchmark (BenchmarkState& state)
+
+#define TESTMAIN int main(int argc, char **argv) { return TestRegistry::main(argc, argv); }
+
+#endif // CPP_UNIT_X_LITE_MACROS_H_
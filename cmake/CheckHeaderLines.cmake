@@ -0,0 +1,19 @@
+# Fails if a file including nothing but HEADER preprocesses to more than
+# LIMIT lines.
+#
+#   cmake -DCOMPILER=g++ -DHEADER=CppUnitXLite.hpp -DLIMIT=41000 -P CheckHeaderLines.cmake
+
+execute_process(COMMAND ${COMPILER} -std=c++23 -E -x c++ ${HEADER}
+        OUTPUT_VARIABLE preprocessed
+        RESULT_VARIABLE failed)
+if(failed)
+    message(FATAL_ERROR "cannot preprocess ${HEADER}")
+endif()
+
+string(REGEX MATCHALL "\n" newlines "${preprocessed}")
+list(LENGTH newlines lines)
+if(lines GREATER LIMIT)
+    message(FATAL_ERROR "${HEADER} preprocesses to ${lines} lines, more than the ${LIMIT} allowed; "
+            "declare what it needs in CppUnitXLite.cpp, or raise CPP_UNIT_X_LITE_HEADER_LINES")
+endif()
+message(STATUS "${HEADER} preprocesses to ${lines} lines")
@@ -23,12 +23,27 @@ THE SOFTWARE.
 /**
   *  Test CppUnitXLite
   */
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <list>
+#include <numeric>
+#include <sstream>
 #include <stdexcept>
 #include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 // Inexpensive way to get one-time linker definitions without mucking up the command line.
+#if !defined(CPP_UNIT_X_LITE_TRACK_ALLOCATIONS)
+#define CPP_UNIT_X_LITE_TRACK_ALLOCATIONS
+#endif
 #include "CppUnitXLite.cpp"
 #include "CppUnitXLiteTests.hpp"
 
@@ -96,6 +111,46 @@ TEST(CppUnitXLiteTest, CheckApproxEqual)
 }
 
 
+TEST(CppUnitXLiteTest, CheckAllApproxEqual)
+{
+  std::vector<double> expected(1001);
+  for (std::size_t i = 0; i < expected.size(); ++i) expected[i] = std::sin(0.01 * i);
+  std::vector<double> actual(expected);
+  actual[10] = std::nextafter(actual[10], 2.0);
+  CHECK_ALL_APPROX_EQUAL(expected, actual, ApproxTolerance{ .ulps = 1 });
+  CHECK_ALL_APPROX_EQUAL(expected, actual, ApproxTolerance{ .absolute = 1.0e-12 });
+  actual[700] += 0.5;
+  CHECK_ALL_APPROX_EQUAL(expected, actual, ApproxTolerance{ .absolute = 1.0e-6, .relative = 1.0e-6 });  ++expectedFailures;
+
+  std::vector<float> expectedFloats(expected.begin(), expected.end());
+  std::vector<float> actualFloats(expectedFloats);
+  actualFloats[1000] = std::nextafter(actualFloats[1000], 2.0f);
+  actualFloats[1000] = std::nextafter(actualFloats[1000], 2.0f);
+  CHECK_ALL_APPROX_EQUAL(expectedFloats, actualFloats, ApproxTolerance{ .ulps = 2 });
+  CHECK_ALL_APPROX_EQUAL(expectedFloats, actualFloats, ApproxTolerance{ .ulps = 1 });  ++expectedFailures;
+}
+
+
+TEST(CppUnitXLiteTest, CheckAllApproxEqualDiagnostics)
+{
+  InstrumentedResult local;
+  std::vector<float> expected(37, 1.0f);
+  std::vector<float> actual(expected);
+  actual[3] = 1.25f;
+  actual[20] = 3.0f;
+  actual[30] = std::nanf("");
+  checkAllApproxEqual(expected, actual, ApproxTolerance{ .relative = 0.5 }, local);
+  checkAllApproxEqual(expected, std::vector<float>(36, 1.0f), ApproxTolerance{}, local);
+
+  std::vector<Failure> failures(local.begin(), local.end());
+  CHECK_EQUAL(2ul, failures.size());
+  CHECK_EQUAL(std::string("2 of 37 elements out of tolerance, the first at index 20; largest error 2 "
+                          "at index 20 (expected 1 but received 3); RMS error nan"),
+              std::string(failures[0].message));
+  CHECK_EQUAL(std::string("expected 37 elements but received 36"), std::string(failures[1].message));
+}
+
+
 TEST(CppUnitXLiteTest, CheckConstCharStar)
 {
   static constexpr char actual[] = "aardvark";
@@ -103,6 +158,73 @@ TEST(CppUnitXLiteTest, CheckConstCharStar)
   CHECK_EQUAL("giraffe", actual);  ++expectedFailures;
 }
 
+struct LastDigit
+{
+  int value;
+  bool operator==(const LastDigit &other) const { return value % 10 == other.value % 10; }
+};
+
+
+TEST(CppUnitXLiteTest, CheckEqualRanges)
+{
+  std::vector<std::uint8_t> expected(1000, 7);
+  std::vector<std::uint8_t> actual(expected);
+  CHECK_EQUAL(expected, actual);
+  actual[500] = 9;
+  CHECK_EQUAL(expected, actual);  ++expectedFailures;
+
+  std::list<double> values = { 1.0, 2.0, 3.0 };
+  std::array<double, 3> same = { 1.0, 2.0, 3.0 };
+  CHECK_EQUAL(values, same);
+
+  int left[] = { 1, 2, 3 };
+  int right[] = { 1, 2, 3 };
+  CHECK_EQUAL(left, right);
+
+  // Equal by operator== though not byte for byte.
+  std::vector<LastDigit> digits = { { 1 }, { 2 }, { 3 } };
+  std::vector<LastDigit> sameDigits = { { 11 }, { 22 }, { 33 } };
+  CHECK_EQUAL(digits, sameDigits);
+  sameDigits[2].value = 34;
+  CHECK_EQUAL(digits, sameDigits);  ++expectedFailures;
+}
+
+
+struct Unprintable
+{
+  int value;
+  bool operator==(const Unprintable &other) const { return value == other.value; }
+};
+
+
+TEST(CppUnitXLiteTest, CheckEqualRangeDiagnostics)
+{
+  InstrumentedResult local;
+  std::vector<std::uint8_t> expected(100, 1);
+  std::vector<std::uint8_t> actual(expected);
+  actual[50] = 2;
+  checkEqual(expected, actual, local);
+
+  std::vector<int> shorter = { 1, 2, 3 };
+  std::vector<int> longer = { 1, 2, 3, 4 };
+  checkEqual(shorter, longer, local);
+
+  std::list<Unprintable> unprintable = { { 1 }, { 2 } };
+  std::list<Unprintable> other = { { 1 }, { 3 } };
+  checkEqual(unprintable, other, local);
+
+  std::vector<Failure> failures(local.begin(), local.end());
+  CHECK_EQUAL(3ul, failures.size());
+  CHECK_EQUAL(std::string("first difference at index 50: expected 1 but received 2; "
+                          "expected [... 1, 1, 1, 1, 1, 1, 1 ...] received [... 1, 1, 1, 2, 1, 1, 1 ...]"),
+              std::string(failures[0].message));
+  CHECK_EQUAL(std::string("expected 3 elements but received 4; expected [1, 2, 3] received [1, 2, 3, 4]"),
+              std::string(failures[1].message));
+  CHECK_EQUAL(std::string("first difference at index 1: expected ? but received ?; expected [?, ?] received [?, ?]"),
+              std::string(failures[2].message));
+}
+
+
 TEST(CppUnitXLiteTest, CheckRelationalOperators)
 {
   CHECK_LE(4, 5);
@@ -113,20 +235,1058 @@ TEST(CppUnitXLiteTest, CheckRelationalOperators)
   CHECK_GT(5, 4);
 }
 
+TEST(CppUnitXLiteTest, RunOptionsFromCommandLine)
+{
+  char program[] = "tests";
+  char jobs[] = "--jobs=4";
+  char durations[] = "--durations=times.txt";
+  char *argv[] = { program, jobs, durations, NULL };
+  RunOptions options = RunOptions::fromCommandLine(3, argv);
+  CHECK_EQUAL(4u, options.jobs);
+  CHECK_EQUAL(std::string("times.txt"), options.durationsFile);
+
+  char shortJobs[] = "-j0";
+  char *shortArgv[] = { program, shortJobs, NULL };
+  CHECK_EQUAL(0u, RunOptions::fromCommandLine(2, shortArgv).jobs);
+
+  char bogus[] = "--jobs=many";
+  char *bogusArgv[] = { program, bogus, NULL };
+  bool rejected = false;
+  try { RunOptions::fromCommandLine(2, bogusArgv); } catch (const std::invalid_argument &) { rejected = true; }
+  CHECK(rejected);
+}
+
+TEST(CppUnitXLiteTest, RunOptionsShard)
+{
+  char program[] = "tests";
+  char shard[] = "--shard=2/5";
+  char isolate[] = "--isolate";
+  char *argv[] = { program, shard, isolate, NULL };
+  RunOptions options = RunOptions::fromCommandLine(3, argv);
+  CHECK_EQUAL(2u, options.shardIndex);
+  CHECK_EQUAL(5u, options.shardCount);
+  CHECK(options.isolate);
+
+  char outside[] = "--shard=5/5";
+  char *outsideArgv[] = { program, outside, NULL };
+  bool rejected = false;
+  try { RunOptions::fromCommandLine(2, outsideArgv); } catch (const std::invalid_argument &) { rejected = true; }
+  CHECK(rejected);
+}
+
+TEST(CppUnitXLiteTest, RunOptionsReporter)
+{
+  char program[] = "tests";
+  char junit[] = "--reporter=junit:results.xml";
+  char *argv[] = { program, junit, NULL };
+  CHECK_EQUAL(std::string("junit:results.xml"), RunOptions::fromCommandLine(2, argv).reporter);
+
+  char unknown[] = "--reporter=tap:results.tap";
+  char *unknownArgv[] = { program, unknown, NULL };
+  bool rejected = false;
+  try { RunOptions::fromCommandLine(2, unknownArgv); } catch (const std::invalid_argument &) { rejected = true; }
+  CHECK(rejected);
+}
+
+TEST(CppUnitXLiteTest, RunOptionsFilter)
+{
+  char program[] = "tests";
+  char filter[] = "--filter=Parser.*,Lexer.Scan";
+  char exclude[] = "--exclude=/Slow$/";
+  char list[] = "--list";
+  char *argv[] = { program, filter, exclude, list, NULL };
+  RunOptions options = RunOptions::fromCommandLine(4, argv);
+  CHECK_EQUAL(1ul, options.filters.size());
+  CHECK_EQUAL(std::string("Parser.*,Lexer.Scan"), options.filters[0]);
+  CHECK_EQUAL(std::string("/Slow$/"), options.excludes[0]);
+  CHECK(options.list);
+}
+
+TEST(CppUnitXLiteTest, RunOptionsMeasurements)
+{
+  char program[] = "tests";
+  char allocations[] = "--allocations";
+  char counters[] = "--counters";
+  char *argv[] = { program, allocations, counters, NULL };
+  RunOptions options = RunOptions::fromCommandLine(3, argv);
+  CHECK(options.allocations);
+  CHECK(options.counters);
+  CHECK(!RunOptions().counters);
+
+  char pin[] = "--pin-threads";
+  char yield[] = "--yield=16";
+  char *concurrency[] = { program, pin, yield, NULL };
+  options = RunOptions::fromCommandLine(3, concurrency);
+  CHECK(options.pinThreads);
+  CHECK_EQUAL(16u, options.yieldOneIn);
+  CHECK(!options.updateSnapshots);
+
+  char update[] = "--update-snapshots";
+  char *snapshots[] = { program, update, NULL };
+  CHECK(RunOptions::fromCommandLine(2, snapshots).updateSnapshots);
+
+  char cache[] = "--cache=results.cache";
+  char inputs[] = "--cache-inputs=a.bin,b.bin";
+  char rerun[] = "--rerun-failed";
+  char *cached[] = { program, cache, inputs, rerun, NULL };
+  options = RunOptions::fromCommandLine(4, cached);
+  CHECK_EQUAL(std::string("results.cache"), options.cacheFile);
+  CHECK_EQUAL(std::size_t(2), options.cacheInputs.size());
+  CHECK(options.rerunFailed);
+  char *uncached[] = { program, rerun, NULL };
+  bool refused = false;
+  try
+  {
+    RunOptions::fromCommandLine(2, uncached);
+  }
+  catch (const std::invalid_argument &)
+  {
+    refused = true;
+  }
+  CHECK(refused);
+
+  char profile[] = "--profile=tests.folded";
+  char isolate[] = "--isolate";
+  char *profiled[] = { program, profile, NULL };
+  CHECK_EQUAL(std::string("tests.folded"), RunOptions::fromCommandLine(2, profiled).profileFile);
+  char *profiledApart[] = { program, profile, isolate, NULL };
+  refused = false;
+  try
+  {
+    RunOptions::fromCommandLine(3, profiledApart);
+  }
+  catch (const std::invalid_argument &)
+  {
+    refused = true;
+  }
+  CHECK(refused);
+}
+
+TEST(CppUnitXLiteTest, RunOptionsTimeouts)
+{
+  char program[] = "tests";
+  char perTest[] = "--timeout=2.5";
+  char wholeRun[] = "--run-timeout=600";
+  char *argv[] = { program, perTest, wholeRun, NULL };
+  RunOptions options = RunOptions::fromCommandLine(3, argv);
+  CHECK_EQUAL(2.5, options.timeoutSeconds);
+  CHECK_EQUAL(600.0, options.runTimeoutSeconds);
+  CHECK_EQUAL(0.0, RunOptions().timeoutSeconds);
+
+  char negative[] = "--timeout=-1";
+  char *negativeArgv[] = { program, negative, NULL };
+  bool rejected = false;
+  try { RunOptions::fromCommandLine(2, negativeArgv); } catch (const std::invalid_argument &) { rejected = true; }
+  CHECK(rejected);
+  CHECK_EQUAL(0.0, timeout());
+}
+
+TEST(CppUnitXLiteTest, DeclaresItsTimeout, 30.0)
+{
+  CHECK_EQUAL(30.0, timeout());
+  CHECK_EQUAL(30.0, entry.timeoutSeconds);
+}
+
+TEST(CppUnitXLiteTest, RegistryKeepsDeclaredOrderAndLocation)
+{
+  const std::vector<TestInfo> &tests = TestRegistry::tests();
+  auto find = [&tests](std::string_view name) {
+    return std::find_if(tests.begin(), tests.end(), [name](const TestInfo &info) { return info.name == name; });
+  };
+  auto self = find("RegistryKeepsDeclaredOrderAndLocation");
+  CHECK(self != tests.end() && self->test == this);
+  CHECK(self != tests.end() && self->entry != nullptr && &self->entry->instance() == this);
+  CHECK(self != tests.end() && self->group == "CppUnitXLiteTest");
+  CHECK(self != tests.end() && self->file == __FILE__);
+  CHECK(self != tests.end() && self->line == line() && line() > 0);
+  CHECK(find("RunOptionsFilter") < self);
+}
+
+CONSTEXPR_TEST(CppUnitXLiteTest, ConstexprChecks)
+{
+  constexpr std::array<int, 3> primes{2, 3, 5};
+  CHECK(primes[0] == 2);
+  CHECK_EQUAL(10, std::accumulate(primes.begin(), primes.end(), 0));
+  CHECK_EQUAL("giraffe", "giraffe");
+  CHECK_EQUAL(primes, (std::array<int, 3>{2, 3, 5}));
+  CHECK_LT(2, primes[1]);
+  CHECK(std::string_view(theResult.expression) == "CHECK_LT(2, primes[1])");
+  CHECK_APPROX_EQUAL(1.0, 1.05, 0.1);
+}
+
+TEST(CppUnitXLiteTest, ConstexprTestIsRegistered)
+{
+  const std::vector<TestInfo> &tests = TestRegistry::tests();
+  auto declared = std::find_if(tests.begin(), tests.end(), [](const TestInfo &info) { return info.name == "ConstexprChecks"; });
+  CHECK(declared != tests.end() && declared->entry != nullptr);
+  if (declared == tests.end()) return;
+
+  TestResult counted;
+  declared->entry->instance().run(counted);
+  CHECK_EQUAL(7ul, counted.checks());
+  CHECK_EQUAL(0ul, counted.failedChecks());
+}
+
+struct CountedTable
+{
+  CountedTable() { ++constructed; }
+  ~CountedTable() { ++destroyed; }
+
+  static int constructed;
+  static int destroyed;
+};
+
+int CountedTable::constructed = 0;
+int CountedTable::destroyed = 0;
+
+struct TableFixture
+{
+  int answer = 42;
+  SharedFixture<CountedTable> table;
+};
+
+TEST_F(TableFixture, SharesOneTable)
+{
+  CHECK_EQUAL(42, answer);
+  CHECK_EQUAL(1, CountedTable::constructed);
+  CHECK_EQUAL(0, CountedTable::destroyed);
+}
+
+TEST_F(TableFixture, KeepsTableUntilGroupEnds)
+{
+  answer = 0;
+  CHECK_EQUAL(1, CountedTable::constructed);
+  CHECK_EQUAL(0, CountedTable::destroyed);
+}
+
+struct CountedCache
+{
+  CountedCache() { ++constructed; }
+
+  static std::atomic<int> constructed;
+};
+
+std::atomic<int> CountedCache::constructed = 0;
+
+// The group keeps the one cache for each thread and iteration of the one
+// test, and for the coroutine of the other, until both have ended.
+CONCURRENT_TEST(SharedCache, SharedAcrossThreads, 4, 100)
+{
+  SharedFixture<CountedCache> cache(*this);
+  CHECK_EQUAL(1, CountedCache::constructed.load());
+}
+
+ASYNC_TEST(SharedCache, SharedAcrossAwaits)
+{
+  SharedFixture<CountedCache> cache(*this);
+  co_await sleepFor(std::chrono::milliseconds(1));
+  SharedFixture<CountedCache> again(*this);
+  CHECK_EQUAL(1, CountedCache::constructed.load());
+}
+
+CONCURRENT_TEST(CppUnitXLiteTest, ConcurrentRunsEveryThread, 4, 1000)
+{
+  CHECK(threadIndex < 4);
+  CHECK(iteration < 1000);
+}
+
+TEST(CppUnitXLiteTest, ConcurrentTestReportsThroughput)
+{
+  struct ThroughputResult : TestResult
+  {
+    void addThroughput(const ThroughputStats &stats) override
+    {
+      threads = stats.threads;
+      rates = stats.opsPerSecond.size();
+    }
+
+    unsigned int threads = 0;
+    std::size_t rates = 0;
+  };
+
+  const std::vector<TestInfo> &tests = TestRegistry::tests();
+  auto declared = std::find_if(tests.begin(), tests.end(), [](const TestInfo &info) { return info.name == "ConcurrentRunsEveryThread"; });
+  CHECK(declared != tests.end());
+  if (declared == tests.end()) return;
+
+  ThroughputResult counted;
+  declared->entry->instance().run(counted);
+  CHECK_EQUAL(8000ul, counted.checks());
+  CHECK_EQUAL(0ul, counted.failedChecks());
+  CHECK_EQUAL(4u, counted.threads);
+  CHECK_EQUAL(std::size_t(4), counted.rates);
+}
+
+static AsyncTask doubledLater(int &value)
+{
+  co_await AsyncTest::sleepFor(std::chrono::milliseconds(1));
+  value *= 2;
+}
+
+ASYNC_TEST(CppUnitXLiteTest, AsyncAwaitsTimersPipesAndFutures)
+{
+  auto start = std::chrono::steady_clock::now();
+  co_await sleepFor(std::chrono::milliseconds(5));
+  CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(5));
+
+  int ends[2];
+  CHECK_EQUAL(0, ::pipe(ends));
+  co_await writable(ends[1]);
+  CHECK_EQUAL(1l, static_cast<long>(::write(ends[1], "x", 1)));
+  co_await readable(ends[0]);
+  char received = 0;
+  CHECK_EQUAL(1l, static_cast<long>(::read(ends[0], &received, 1)));
+  CHECK_EQUAL('x', received);
+  ::close(ends[0]);
+  ::close(ends[1]);
+
+  std::future<int> answer = std::async(std::launch::async, [] { return 42; });
+  CHECK_EQUAL(42, co_await ready(answer));
+
+  int value = 21;
+  co_await doubledLater(value);
+  CHECK_EQUAL(42, value);
+}
+
+TEST(CppUnitXLiteTest, AsyncTestsInterleaveAndReportStalls)
+{
+  struct PipeTest : AsyncTest
+  {
+    PipeTest(const TestEntry &entry, int theFd, bool theWriter) : AsyncTest(entry), fd(theFd), writer(theWriter) { }
+
+    AsyncTask body(TestResult &theResult) override
+    {
+      if (writer)
+      {
+        co_await sleepFor(std::chrono::milliseconds(1));
+        CHECK_EQUAL(2l, static_cast<long>(::write(fd, "xy", 2)));
+      }
+      else
+      {
+        co_await readable(fd);
+        char received = 0;
+        CHECK_EQUAL(1l, static_cast<long>(::read(fd, &received, 1)));
+      }
+    }
+
+    int fd;
+    bool writer;
+  };
+
+  int ends[2];
+  CHECK_EQUAL(0, ::pipe(ends));
+  static constinit const TestEntry readerEntry{ "Async", "Reader", __FILE__, __LINE__, false, nullptr };
+  static constinit const TestEntry otherReaderEntry{ "Async", "OtherReader", __FILE__, __LINE__, false, nullptr };
+  static constinit const TestEntry writerEntry{ "Async", "Writer", __FILE__, __LINE__, false, nullptr };
+  PipeTest reader(readerEntry, ends[0], false);
+  PipeTest otherReader(otherReaderEntry, ends[0], false);
+  PipeTest writer(writerEntry, ends[1], true);
+
+  // The readers, waiting on the same pipe, only finish if the writer runs
+  // while they wait.
+  std::vector<Test *> list{ &reader, &otherReader, this, &writer };
+  TestResult quiet;
+  Durations durations;
+  runAsyncTests(list, quiet, durations);
+  CHECK_EQUAL(std::size_t(1), list.size());
+  CHECK_EQUAL(3ul, quiet.checks());
+  CHECK_EQUAL(0ul, quiet.failedChecks());
+  CHECK_EQUAL(std::size_t(3), durations.size());
+
+  ::close(ends[0]);
+  ::close(ends[1]);
+
+  struct StuckTest : AsyncTest
+  {
+    using AsyncTest::AsyncTest;
+
+    // Suspends without telling the loop what would resume it.
+    AsyncTask body(TestResult &) override { co_await std::suspend_always(); }
+  };
+
+  static constinit const TestEntry stuckEntry{ "Async", "Stuck", __FILE__, __LINE__, false, nullptr };
+  StuckTest stuck(stuckEntry);
+  BufferedResult stalled;
+  stuck.run(stalled);
+  CHECK_EQUAL(1ul, stalled.failedChecks());
+}
+
+TEST_DATA(CppUnitXLiteTest, DataRowsAreLines, "squares.txt")
+{
+  std::istringstream row{ std::string(record.text()) };
+  unsigned long n = 0;
+  unsigned long square = 0;
+  row >> n >> square;
+  CHECK_EQUAL(record.index(), n);
+  CHECK_EQUAL(n * n, square);
+  CHECK(record.text().back() != '\r');
+}
+
+TEST(CppUnitXLiteTest, DataRecordsSplitAndNameFailingRecords)
+{
+  struct Counted : DataTest
+  {
+    using DataTest::DataTest;
+
+    void checkRecord(TestResult &theResult, const DataRecord &record) override
+    {
+      CHECK_EQUAL(record.index(), record.field<std::uint64_t>(8));
+      CHECK(record.index() != 150000);
+    }
+  };
+
+  // Three megabytes, so -j2 or more splits them.
+  std::string path = (std::filesystem::temp_directory_path() / "CppUnitXLiteRecords.bin").string();
+  {
+    std::ofstream out(path, std::ios::binary);
+    for (std::uint64_t index = 0; index < 200000; ++index)
+    {
+      std::uint64_t record[2] = { 0, index };
+      out.write(reinterpret_cast<const char *>(record), sizeof record);
+    }
+    out.write("tail", 4);
+  }
+  static constinit const TestEntry entry{ "Data", "Counted", __FILE__, __LINE__, false, nullptr };
+  Counted counted(entry, path.c_str(), DataFormat(16));
+  InstrumentedResult local;
+  counted.run(local);
+  std::filesystem::remove(path);
+
+  std::vector<Failure> failures(local.begin(), local.end());
+  CHECK_EQUAL(400000ul, local.checks());
+  CHECK_EQUAL(2ul, failures.size());
+  CHECK(failures.size() == 2 && failures[0].message == "record 150000: record.index() != 150000");
+  CHECK(failures.size() == 2 && failures[1].message.ends_with(" ends with 4 bytes of a record of 16"));
+
+  std::span<const std::byte> rows = std::as_bytes(std::span<const char>("a\nbb\ncc", 8));
+  CHECK_EQUAL(std::size_t(3), countRecords(rows, DataFormat()));
+  CHECK_EQUAL(std::size_t(5), recordBoundary(rows, DataFormat(), 3));
+  CHECK_EQUAL(std::size_t(4), recordBoundary(rows, DataFormat(2), 5));
+
+  Counted missing(entry, "no such vectors.bin", DataFormat(16));
+  InstrumentedResult unmapped;
+  missing.run(unmapped);
+  CHECK_EQUAL(1ul, unmapped.failedChecks());
+}
+
+TEST(CppUnitXLiteTest, SnapshotsCompareWithGoldenFiles)
+{
+  CHECK_SNAPSHOT("report.txt", std::string("Report\n======\ntests: 3\nfailures: 0\n"));
+
+  InstrumentedResult local;
+  checkSnapshot("report.txt", std::string_view("Report\n======\ntests: 3\nfailures: 1\n"), local, __FILE__, __LINE__);
+  std::vector<std::byte> binary(40, std::byte(0));
+  checkSnapshot("report.txt", binary, local, __FILE__, __LINE__);
+  checkSnapshot("missing.txt", std::string_view(), local, __FILE__, __LINE__);
+
+  std::vector<Failure> failures(local.begin(), local.end());
+  CHECK_EQUAL(std::size_t(3), failures.size());
+  if (failures.size() != 3) return;
+  CHECK(failures[0].message.ends_with("snapshots/report.txt differs at byte 33 (golden 35 bytes, actual 35), line 4:\n"
+                                      "  ======\n  tests: 3\n- failures: 0\n+ failures: 1"));
+  CHECK(failures[1].message.ends_with("differs at byte 0 (golden 35 bytes, actual 40):\n"
+                                      "- 00000000: 52 65 70 6f 72 74 0a 3d 3d 3d 3d 3d 3d 0a 74 65\n"
+                                      "- 00000010: 73 74 73 3a 20 33 0a 66 61 69 6c 75 72 65 73 3a\n"
+                                      "- 00000020: 20 30 0a\n"
+                                      "+ 00000000: 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00\n"
+                                      "+ 00000010: 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00 00\n"
+                                      "+ 00000020: 00 00 00 00 00 00 00 00"));
+  CHECK(failures[2].message.find("snapshots/missing.txt") != std::string_view::npos);
+
+  std::string path = (std::filesystem::temp_directory_path() / "CppUnitXLiteSnapshot" / "golden.bin").string();
+  CHECK(writeSnapshot(path, std::as_bytes(std::span<const char>("new", 3))));
+  CHECK(!std::filesystem::exists(path + ".new"));
+  MappedFile written;
+  CHECK(written.open(path));
+  CHECK(written.text() == "new");
+  std::filesystem::remove_all(std::filesystem::path(path).parent_path());
+}
+
+TEST(CppUnitXLiteTest, ResultCacheSkipsWhatPassedInThisBuild)
+{
+  std::filesystem::path directory = std::filesystem::temp_directory_path() / "CppUnitXLiteCache";
+  std::filesystem::create_directories(directory);
+  std::string input = (directory / "input.txt").string();
+  std::ofstream(input) << "one";
+
+  RunOptions options;
+  options.cacheFile = (directory / "results.cache").string();
+  options.cacheInputs.push_back(input);
+  ResultCache &cache = ResultCache::instance();
+  cache.load(options);
+  CHECK(!buildIdentity().empty());
+  CHECK(!cache.passedBefore(*this));
+  cache.record(*this, true);
+  cache.save();
+
+  cache.load(options);
+  CHECK(cache.passedBefore(*this));
+  CHECK(!cache.failedBefore(*this));
+  cache.record(*this, false);
+  cache.save();
+  cache.load(options);
+  CHECK(!cache.passedBefore(*this));
+  CHECK(cache.failedBefore(*this));
+  cache.record(*this, true);
+  cache.save();
+
+  // Another input is another key.
+  std::ofstream(input) << "two";
+  cache.load(options);
+  CHECK(!cache.passedBefore(*this));
+
+  cache.load(RunOptions());
+  std::filesystem::remove_all(directory);
+}
+
+#if defined(__linux__)
+namespace {
+
+[[gnu::noinline]] int
+unexportedFunction(int value)
+{
+  return value * 3;
+}
+
+} // namespace
+
+TEST(CppUnitXLiteTest, ProfilerNamesUnexportedFunctions)
+{
+  CHECK_EQUAL(6, unexportedFunction(2));
+  Symbolizer symbolizer;
+  void *address = reinterpret_cast<void *>(reinterpret_cast<std::uintptr_t>(&unexportedFunction) + 1);
+  CHECK(symbolizer.name(address).find("unexportedFunction(int)") != std::string::npos);
+  CHECK_EQUAL(symbolizer.name(address), symbolizer.name(address));
+}
+#endif
+
+TEST(CppUnitXLiteTest, ReportersWriteEachTestAsItEnds)
+{
+  TestStats stats;
+  stats.wallSeconds = 0.25;
+  stats.checks = 3;
+
+  std::ostringstream xml;
+  JUnitXmlResult junit(xml);
+  junit.testStarted(*this);
+  junit.testEnded(*this, stats);
+  CHECK(xml.str().find("<testcase classname=\"CppUnitXLiteTest\" name=\"ReportersWriteEachTestAsItEnds\" time=\"0.250000\"/>\n")
+        != std::string::npos);
+  junit.testCached(*this);
+  junit.testsEnded();
+  CHECK(xml.str().find("<testsuite name=\"CppUnitXLite\" tests=\"2\" failures=\"0\" skipped=\"1\" ") != std::string::npos);
+  CHECK(xml.str().ends_with("</testsuite>\n</testsuites>\n"));
+
+  std::ostringstream lines;
+  JsonLinesResult jsonl(lines);
+  jsonl.testStarted(*this);
+  jsonl.testEnded(*this, stats);
+  CHECK_EQUAL(std::string("{\"group\":\"CppUnitXLiteTest\",\"test\":\"ReportersWriteEachTestAsItEnds\",\"passed\":true,"
+                          "\"seconds\":0.250000,\"checks\":3,\"failures\":[]}\n"),
+              lines.str());
+}
+
+TEST(CppUnitXLiteTest, ResultCountsChecksAndFailures)
+{
+  InstrumentedResult local;
+  check(local, true, "passes");
+  check(local, false, "fails");
+  checkEqual(1, 2, local);
+  CHECK_EQUAL(3ul, local.checks());
+  CHECK_EQUAL(2ul, local.failedChecks());
+  CHECK_EQUAL(2u, local.numberFailures());
+}
+
+
+TEST(CppUnitXLiteTest, FailureMessagesLiveInResultArena)
+{
+  InstrumentedResult local;
+  checkEqual(1, 2, local, "file.cpp", 7);
+  std::string longText(40000, 'x');
+  fail(local, longText.c_str());
+  checkEqual(std::string("a"), std::string("b"), local);
+
+  std::vector<Failure> failures(local.begin(), local.end());
+  CHECK_EQUAL(3ul, failures.size());
+  CHECK(failures[0].message == "expected: 1 but received: 2");
+  CHECK(failures[0].fileName == "file.cpp");
+  CHECK_EQUAL(7u, failures[0].lineNumber);
+  CHECK(failures[0].testName == "FailureMessagesLiveInResultArena");
+  CHECK(failures[1].message == longText);
+  CHECK(failures[2].message == "expected: a but received: b");
+}
+
+
+TEST(CppUnitXLiteTest, ClearedArenaKeepsOneBlock)
+{
+  MessageArena arena;
+  std::string longText(40000, 'x');
+  for (int i = 0; i < 3; ++i) CHECK(arena.store(longText) == longText);
+  std::size_t held = arena.capacity();
+  arena.clear();
+  CHECK(arena.capacity() > 0 && arena.capacity() < held);
+  CHECK(arena.store("after") == "after");
+  CHECK(arena.capacity() < held);
+}
+
+
+TEST(CppUnitXLiteTest, CheckAllocations)
+{
+  std::vector<int> reserved;
+  reserved.reserve(16);
+  CHECK_NO_ALLOC
+  {
+    for (int i = 0; i < 16; ++i) reserved.push_back(i);
+  }
+
+  CHECK_MAX_ALLOCATIONS(1, 1024)
+  {
+    std::vector<int> grown(64);
+    CHECK_EQUAL(64ul, grown.size());
+  }
+
+  ++expectedFailures;
+  CHECK_NO_ALLOC
+  {
+    std::unique_ptr<int> held(new int(7));
+    CHECK_EQUAL(7, *held);
+  }
+
+  AllocationScope scope(0, 0);
+  std::unique_ptr<double[]> buffer(new double[4]);
+  CHECK_EQUAL(1ull, scope.used().allocations);
+  CHECK_EQUAL(4 * sizeof(double), static_cast<std::size_t>(scope.used().bytes));
+}
+
+
+TEST(CppUnitXLiteTest, CheckNotSlowerSamplesTheBlock)
+{
+  unsigned long long runs = 0;
+  PerformanceSample sample("increment", 0.10);
+  while (sample.running()) ++runs;
+  CHECK_EQUAL(21ul, sample.samples().size());
+  CHECK(runs > sample.samples().size());
+
+  // Without a baseline there is nothing to be slower than.
+  CHECK_NOT_SLOWER("accumulate", 0.10)
+  {
+    std::vector<int> values(64, 1);
+    CHECK_EQUAL(64, std::accumulate(values.begin(), values.end(), 0));
+  }
+
+  char program[] = "tests";
+  char update[] = "--update-baselines";
+  char *argv[] = { program, update, NULL };
+  bool rejected = false;
+  try { RunOptions::fromCommandLine(2, argv); } catch (const std::invalid_argument &) { rejected = true; }
+  CHECK(rejected);
+}
+
+
+TEST(CppUnitXLiteTest, BenchmarkStateCountsIterations)
+{
+  BenchmarkState state(5);
+  unsigned int iterations = 0;
+  while (state.keepRunning()) ++iterations;
+  CHECK_EQUAL(5u, iterations);
+  CHECK_GE(state.elapsedNanoseconds(), 0LL);
+}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+// Set in the child processes of runInChild(); the Probe groups only do
+// their work there.
+bool probing = false;
+
+/**
+ * What a run tells its result, a line per event, written to fd when the
+ * run ends.
+ */
+class EventLog : public TestResult
+{
+public:
+  explicit EventLog(int theFd) : fd(theFd) { }
+
+  void testStarted(const Test &test) override { events << "started " << test.name() << '\n'; }
+
+  void addFailure(const Failure &failure) override { events << "failed " << failure.testName << ": " << failure.message << '\n'; }
+
+  void testEnded(const Test &test, const TestStats &stats) override
+  {
+    events << "ended " << test.name() << ' ' << stats.checks << ' ' << stats.failures << '\n';
+  }
+
+  void testsEnded() override
+  {
+    std::string text = events.str();
+    writeFully(fd, text.data(), text.size());
+  }
+
+private:
+  int fd;
+  std::ostringstream events;
+};
+
+/**
+ * Run the tests options selects in a child process, so their run neither
+ * disturbs nor is disturbed by this one, and return the child's EventLog
+ * followed by "exit STATUS".
+ */
+std::string
+runInChild(const RunOptions &options)
+{
+  int channel[2];
+  if (::pipe(channel) != 0) return std::string();
+  console().drain();
+  std::cout.flush();
+  pid_t pid = ::fork();
+  if (pid == 0)
+  {
+    ::close(channel[0]);
+    int quiet = ::open("/dev/null", O_WRONLY);
+    ::dup2(quiet, STDOUT_FILENO);
+    ::dup2(quiet, STDERR_FILENO);
+    probing = true;
+    try
+    {
+      EventLog log(channel[1]);
+      TestRegistry::runAll(log, options);
+    }
+    catch (...)
+    {
+      ::_exit(3);
+    }
+    ::_exit(EXIT_SUCCESS);
+  }
+  ::close(channel[1]);
+  std::string events;
+  char chunk[4096];
+  for (ssize_t received = 0; pid > 0 && (received = ::read(channel[0], chunk, sizeof chunk)) != 0; )
+  {
+    if (received > 0) events.append(chunk, static_cast<std::size_t>(received));
+    else if (errno != EINTR) break;
+  }
+  ::close(channel[0]);
+  int status = 0;
+  while (pid > 0 && ::waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+  int exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  return events + "exit " + std::to_string(exitStatus) + "\n";
+}
+
+/// An empty file of a name no other process uses, in the temporary directory.
+std::string
+temporaryFile(const char *name)
+{
+  std::string path = (std::filesystem::temp_directory_path() / name).string() + ".XXXXXX";
+  int fd = ::mkstemp(path.data());
+  if (fd >= 0) ::close(fd);
+  return path;
+}
+
+TEST(ProbeOverrun, Finishes)
+{
+  CHECK(true);
+}
+
+TEST(ProbeOverrun, Sleeps, 0.2)
+{
+  if (probing) std::this_thread::sleep_for(std::chrono::seconds(10));
+}
+
+TEST(ProbeOverrun, FinishesLater)
+{
+  CHECK(true);
+}
+
+ASYNC_TEST(ProbeAsyncOverrun, Stalls, 0.2)
+{
+  if (probing) co_await sleepFor(std::chrono::seconds(10));
+}
+
+TEST(CppUnitXLiteTest, WatchdogFailsOverrunningTests)
+{
+  // Isolated, only the worker running the test ends.
+  RunOptions options;
+  options.filters.push_back("ProbeOverrun.*");
+  options.isolate = true;
+  std::string isolated = runInChild(options);
+  CHECK(isolated.find("failed Sleeps: exceeded its timeout of 0.2 s") != std::string::npos);
+  CHECK(isolated.find("ended Finishes 1 0\n") != std::string::npos);
+  CHECK(isolated.ends_with("exit 0\n"));
+
+  // In process, the run ends, keeping what it measured.
+  options.isolate = false;
+  options.durationsFile = temporaryFile("CppUnitXLiteDurations");
+  std::string watched = runInChild(options);
+  CHECK(watched.find("ended Finishes 1 0\nstarted Sleeps\nfailed Sleeps: exceeded its timeout of 0.2 s") != std::string::npos);
+  CHECK(watched.find("ended Sleeps 0 1\n") != std::string::npos);
+  CHECK(watched.ends_with("exit 1\n"));
+  Durations kept = readDurations(options.durationsFile);
+  CHECK(kept.count("ProbeOverrun.Finishes") == 1 && kept.count("ProbeOverrun.Sleeps") == 1);
+  std::filesystem::remove(options.durationsFile);
+
+  // On two workers, the tests after the overrunning one still report.
+  options.jobs = 2;
+  options.durationsFile = temporaryFile("CppUnitXLiteDurations");
+  std::string parallel = runInChild(options);
+  CHECK(parallel.find("ended Sleeps 0 1\nstarted FinishesLater\nended FinishesLater 1 0\n") != std::string::npos);
+  CHECK(parallel.ends_with("exit 1\n"));
+  kept = readDurations(options.durationsFile);
+  CHECK(kept.count("ProbeOverrun.FinishesLater") == 1);
+  std::filesystem::remove(options.durationsFile);
+
+  // An asynchronous test is watched while it runs on the event loop.
+  RunOptions asynchronous;
+  asynchronous.filters.push_back("ProbeAsyncOverrun.*");
+  std::string stalled = runInChild(asynchronous);
+  CHECK(stalled.find("started Stalls\nfailed Stalls: exceeded its timeout of 0.2 s") != std::string::npos);
+  CHECK(stalled.ends_with("exit 1\n"));
+}
+
+/// Crash with signal, leaving no core file behind.
+void
+crashWith(int signal)
+{
+  rlimit none = { 0, 0 };
+  ::setrlimit(RLIMIT_CORE, &none);
+  ::raise(signal);
+}
+
+TEST(ProbeCrash, Aborts)
+{
+  if (probing) crashWith(SIGABRT);
+}
+
+TEST(ProbeCrash, Segfaults)
+{
+  if (probing) crashWith(SIGSEGV);
+}
+
+TEST(ProbeCrash, RunsAfter)
+{
+  CHECK(true);
+}
+
+TEST(CppUnitXLiteTest, IsolatedCrashesFailOnlyTheirTest)
+{
+  // The worker that crashes is replaced, and the run goes on.
+  RunOptions options;
+  options.filters.push_back("ProbeCrash.*");
+  options.isolate = true;
+  std::string isolated = runInChild(options);
+  CHECK(isolated.find("started Aborts\nfailed Aborts: test crashed with signal " + std::to_string(SIGABRT)) != std::string::npos);
+  CHECK(isolated.find("ended Aborts 0 1\n") != std::string::npos);
+  CHECK(isolated.find("started Segfaults\nfailed Segfaults: test crashed with signal " + std::to_string(SIGSEGV)) != std::string::npos);
+  CHECK(isolated.find("ended Segfaults 0 1\n") != std::string::npos);
+  CHECK(isolated.find("ended RunsAfter 1 0\n") != std::string::npos);
+  CHECK(isolated.ends_with("exit 0\n"));
+
+  // So on several workers.
+  options.jobs = 2;
+  std::string parallel = runInChild(options);
+  CHECK(parallel.find("ended Aborts 0 1\nstarted Segfaults\nfailed Segfaults") != std::string::npos);
+  CHECK(parallel.find("ended Segfaults 0 1\nstarted RunsAfter\nended RunsAfter 1 0\n") != std::string::npos);
+  CHECK(parallel.ends_with("exit 0\n"));
+}
+
+/// Whether this is the first run of a probe counting its runs in runs,
+/// which first takes milliseconds, so that probes dealt to other workers
+/// finish before it.
+bool
+runsOnce(std::atomic<int> &runs, int milliseconds)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+  return ++runs == 1;
+}
+
+TEST(ProbeParallel, First)
+{
+  static std::atomic<int> runs(0);
+  if (probing) CHECK(runsOnce(runs, 60));
+}
+
+TEST(ProbeParallel, Second)
+{
+  static std::atomic<int> runs(0);
+  if (probing) CHECK(runsOnce(runs, 40));
+}
+
+TEST(ProbeParallel, Third)
+{
+  static std::atomic<int> runs(0);
+  if (probing) CHECK(runsOnce(runs, 20));
+}
+
+TEST(ProbeParallel, Fourth)
+{
+  static std::atomic<int> runs(0);
+  if (probing) CHECK(runsOnce(runs, 0));
+}
+
+TEST(ProbeParallel, Fifth)
+{
+  static std::atomic<int> runs(0);
+  if (probing) CHECK(runsOnce(runs, 30));
+}
+
+TEST(ProbeParallel, Sixth)
+{
+  static std::atomic<int> runs(0);
+  if (probing) CHECK(runsOnce(runs, 0));
+}
+
+TEST(CppUnitXLiteTest, ParallelRunReportsEachTestOnceInOrder)
+{
+  std::string expected;
+  for (const char *name : { "First", "Second", "Third", "Fourth", "Fifth", "Sixth" })
+  {
+    expected += std::string("started ") + name + "\nended " + name + " 1 0\n";
+  }
+  expected += "exit 0\n";
+
+  RunOptions options;
+  options.filters.push_back("ProbeParallel.*");
+  options.jobs = 4;
+  CHECK_EQUAL(expected, runInChild(options));
+  options.isolate = true;
+  CHECK_EQUAL(expected, runInChild(options));
+}
+
+TEST(ProbeThrow, Throws)
+{
+  if (!probing) return;
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  throw std::runtime_error("probe");
+}
+
+TEST(ProbeThrow, ThrowsNonStandard)
+{
+  if (probing) throw 42;
+}
+
+CONCURRENT_TEST(ProbeThrow, ThrowsConcurrently, 2, 10)
+{
+  if (probing && threadIndex == 1 && iteration == 0) throw std::runtime_error("probe");
+}
+
+TEST(ProbeThrow, RunsAfter)
+{
+  CHECK(true);
+}
+
+TEST(CppUnitXLiteTest, UnhandledExceptionsFailOnlyTheirTest)
+{
+  std::string expected = "started Throws\nfailed Throws: unhandled exception: probe\nended Throws 0 1\n"
+                         "started ThrowsNonStandard\nfailed ThrowsNonStandard: unhandled non standard exception\n"
+                         "ended ThrowsNonStandard 0 1\n"
+                         "started ThrowsConcurrently\nfailed ThrowsConcurrently: unhandled exception in thread 1: probe\n"
+                         "ended ThrowsConcurrently 0 1\n"
+                         "started RunsAfter\nended RunsAfter 1 0\n"
+                         "exit 0\n";
+
+  // Alike in process, on a pool of threads and in worker processes.  A
+  // test that throws keeps the time it took until then.
+  RunOptions options;
+  options.filters.push_back("ProbeThrow.*");
+  options.durationsFile = temporaryFile("CppUnitXLiteDurations");
+  CHECK_EQUAL(expected, runInChild(options));
+  Durations kept = readDurations(options.durationsFile);
+  CHECK(kept["ProbeThrow.Throws"] >= 0.02);
+  std::filesystem::remove(options.durationsFile);
+  options.durationsFile.clear();
+  options.jobs = 4;
+  CHECK_EQUAL(expected, runInChild(options));
+  options.isolate = true;
+  CHECK_EQUAL(expected, runInChild(options));
+
+  // The result cache runs them again, skipping only the test that passed.
+  RunOptions cached;
+  cached.filters.push_back("ProbeThrow.*");
+  cached.cacheFile = temporaryFile("CppUnitXLiteCache");
+  CHECK_EQUAL(expected, runInChild(cached));
+  std::string again = runInChild(cached);
+  CHECK(again.find("failed Throws: unhandled exception: probe\n") != std::string::npos);
+  CHECK(again.find("failed ThrowsConcurrently: unhandled exception in thread 1: probe\n") != std::string::npos);
+  CHECK(again.find("started RunsAfter") == std::string::npos);
+  std::filesystem::remove(cached.cacheFile);
+  std::filesystem::remove(cached.cacheFile + ".lock");
+}
+
+TEST(CppUnitXLiteTest, JUnitSuiteCountsItsTests)
+{
+  // In a child process, since the probes print their failures.
+  std::string report = temporaryFile("CppUnitXLiteJUnit");
+  console().drain();
+  std::cout.flush();
+  pid_t pid = ::fork();
+  if (pid == 0)
+  {
+    int quiet = ::open("/dev/null", O_WRONLY);
+    ::dup2(quiet, STDOUT_FILENO);
+    probing = true;
+    RunOptions options;
+    options.filters.push_back("ProbeThrow.*");
+    {
+      JUnitXmlResult junit(report);
+      TestRegistry::runAll(junit, options);
+    }
+    ::_exit(EXIT_SUCCESS);
+  }
+  int status = 0;
+  while (pid > 0 && ::waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+  std::ifstream in(report.c_str());
+  std::ostringstream xml;
+  xml << in.rdbuf();
+  CHECK(xml.str().find("<testsuite name=\"CppUnitXLite\" tests=\"4\" failures=\"3\" skipped=\"0\" ") != std::string::npos);
+  CHECK(xml.str().find("<failure message=\"unhandled exception: probe\">") != std::string::npos);
+  std::filesystem::remove(report);
+}
+
+TEST_DATA(ProbeData, Throws, "squares.txt")
+{
+  if (probing && record.index() == 2) throw std::runtime_error("probe");
+}
+
+TEST(CppUnitXLiteTest, DataRecordExceptionsFailTheTest)
+{
+  std::string expected = "started Throws\nfailed Throws: record 2: unhandled exception: probe\nended Throws 0 1\nexit 0\n";
+  RunOptions options;
+  options.filters.push_back("ProbeData.*");
+  options.cacheFile = temporaryFile("CppUnitXLiteCache");
+  CHECK_EQUAL(expected, runInChild(options));
+  // Failed, so not skipped the next time.
+  CHECK_EQUAL(expected, runInChild(options));
+  std::filesystem::remove(options.cacheFile);
+  std::filesystem::remove(options.cacheFile + ".lock");
+}
+#endif
+
+// Runs only with --bench.
+BENCHMARK(CppUnitXLiteTest, CheckEqual)
+{
+  std::string expected = "The rain in Spain";
+  state.setBytesPerIteration(expected.size());
+  while (state.keepRunning())
+  {
+    std::string actual = expected;
+    doNotOptimize(actual == expected);
+  }
+}
+
 // Custom main() to drive tests of the test framework.
 //  In normal circumstances just use the
 //  TESTMAIN
 //  macro.
 
 int
-main(int, char **)
+main(int argc, char **argv)
 {
   int exitStatus = EXIT_FAILURE;
 
   try
   {
     InstrumentedResult tr;
-    TestRegistry::runAll(tr);
+    TestRegistry::runAll(tr, RunOptions::fromCommandLine(argc, argv));
 
     if (tr.numberFailures() != expectedFailures)
     {
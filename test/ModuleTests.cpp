@@ -0,0 +1,53 @@
+// -*- mode:C++; c-basic-offset:2; indent-tabs-mode:nil -*-
+/*
+Copyright 2023 Glen S. Dayton
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+/**
+  *  Test CppUnitXLite through its module interface, with only the macros
+  *  included.
+  */
+#include <string>
+#include <vector>
+
+import CppUnitXLite;
+
+#include "CppUnitXLiteMacros.hpp"
+
+
+TEST(ModuleTest, CheckEqual)
+{
+  CHECK_EQUAL(2, 1 + 1);
+  CHECK_EQUAL(std::string("The rain in Spain"), std::string("The rain in Spain"));
+  std::vector<int> expected = { 1, 2, 3 };
+  std::vector<int> actual = { 1, 2, 3 };
+  CHECK_EQUAL(expected, actual);
+}
+
+
+TEST(ModuleTest, Comparisons)
+{
+  CHECK_LT(1, 2);
+  CHECK_GE(2.0, 2.0);
+  CHECK_APPROX_EQUAL(1.0, 1.05, 0.1);
+}
+
+
+TESTMAIN